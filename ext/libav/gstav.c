@@ -89,11 +89,15 @@ gst_ffmpeg_avcodec_open_sub (AVCodecContext *avctx, AVCodec *codec, AVDictionary
   return ret;
 }
 
+static void gst_ffmpeg_shared_pool_release (AVCodecContext * avctx);
+
 int
 gst_ffmpeg_avcodec_close (AVCodecContext * avctx)
 {
   int ret;
 
+  gst_ffmpeg_shared_pool_release (avctx);
+
   g_mutex_lock (&gst_avcodec_mutex);
   ret = avcodec_close (avctx);
   g_mutex_unlock (&gst_avcodec_mutex);
@@ -113,6 +117,505 @@ gst_ffmpeg_av_find_stream_info (AVFormatContext * ic)
   return ret;
 }
 
+/*
+ * Process-wide worker pool shared by the slice threading of all codec
+ * contexts opened through gst_ffmpeg_avcodec_open_shared().
+ *
+ * Every execute()/execute2() call becomes a batch of jobs in a queue. Pool
+ * workers hand out jobs round-robin over the queued batches so that
+ * instances share the cores fairly, and the calling thread works on its own
+ * batch too while it waits for it to complete. A batch never runs more than
+ * thread_count jobs at once, and each running job gets a distinct threadnr
+ * below thread_count, as libavcodec codecs index per-thread scratch data
+ * with it. libavcodec sets thread_count to the number of slice threads it
+ * opened the context with, which is what the codec sized that data for.
+ *
+ * The workers are started when the first batch is queued and stopped and
+ * joined again when the last context using the pool is closed.
+ */
+typedef struct
+{
+  AVCodecContext *avctx;
+  int (*func) (AVCodecContext * c, void *arg);
+  int (*func2) (AVCodecContext * c, void *arg, int jobnr, int threadnr);
+  gchar *arg;
+  int *ret;
+  int count;
+  int size;
+
+  /* protected by the pool lock */
+  int next;
+  int done;
+  int *free_slots;
+  int n_free_slots;
+  /* signalled when a slot frees up or the batch completes */
+  GCond cond;
+} GstFFMpegPoolBatch;
+
+typedef struct
+{
+  GMutex lock;
+  GCond work_cond;
+  GQueue batches;
+  GPtrArray *workers;
+  guint max_workers;
+  /* contexts that are open with the pool hooks installed */
+  guint n_users;
+  /* bumped to make the running workers exit */
+  guint generation;
+} GstFFMpegPool;
+
+static GstFFMpegPool shared_pool;
+
+/* with pool lock */
+static gboolean
+gst_ffmpeg_pool_batch_claim (GstFFMpegPoolBatch * batch, int *jobnr,
+    int *threadnr)
+{
+  if (batch->next >= batch->count || batch->n_free_slots == 0)
+    return FALSE;
+
+  *jobnr = batch->next++;
+  *threadnr = batch->free_slots[--batch->n_free_slots];
+
+  /* fully handed out, nobody else needs to find it anymore */
+  if (batch->next == batch->count)
+    g_queue_remove (&shared_pool.batches, batch);
+
+  return TRUE;
+}
+
+/* called without the pool lock */
+static void
+gst_ffmpeg_pool_batch_run (GstFFMpegPoolBatch * batch, int jobnr, int threadnr)
+{
+  int r;
+
+  if (batch->func2)
+    r = batch->func2 (batch->avctx, batch->arg, jobnr, threadnr);
+  else
+    r = batch->func (batch->avctx, batch->arg + jobnr * batch->size);
+
+  if (batch->ret)
+    batch->ret[jobnr] = r;
+}
+
+/* with pool lock */
+static void
+gst_ffmpeg_pool_batch_release (GstFFMpegPoolBatch * batch, int threadnr)
+{
+  batch->free_slots[batch->n_free_slots++] = threadnr;
+  batch->done++;
+
+  /* the caller helps with the jobs left as well */
+  if (batch->done == batch->count || batch->next < batch->count)
+    g_cond_signal (&batch->cond);
+  if (batch->next < batch->count)
+    g_cond_signal (&shared_pool.work_cond);
+}
+
+static gpointer
+gst_ffmpeg_pool_worker (gpointer data)
+{
+  guint generation = GPOINTER_TO_UINT (data);
+
+  g_mutex_lock (&shared_pool.lock);
+  while (generation == shared_pool.generation) {
+    GstFFMpegPoolBatch *batch = NULL;
+    GList *l;
+    int jobnr = 0, threadnr = 0;
+
+    for (l = shared_pool.batches.head; l; l = l->next) {
+      if (gst_ffmpeg_pool_batch_claim (l->data, &jobnr, &threadnr)) {
+        batch = l->data;
+        break;
+      }
+    }
+
+    if (batch == NULL) {
+      g_cond_wait (&shared_pool.work_cond, &shared_pool.lock);
+      continue;
+    }
+
+    /* let the other contexts go first next time */
+    if (batch->next < batch->count) {
+      g_queue_remove (&shared_pool.batches, batch);
+      g_queue_push_tail (&shared_pool.batches, batch);
+    }
+
+    g_mutex_unlock (&shared_pool.lock);
+    gst_ffmpeg_pool_batch_run (batch, jobnr, threadnr);
+    g_mutex_lock (&shared_pool.lock);
+
+    gst_ffmpeg_pool_batch_release (batch, threadnr);
+  }
+  g_mutex_unlock (&shared_pool.lock);
+
+  return NULL;
+}
+
+/* with pool lock */
+static void
+gst_ffmpeg_pool_ensure_workers (void)
+{
+  while (shared_pool.workers->len < shared_pool.max_workers) {
+    GError *err = NULL;
+    GThread *thread;
+
+    thread = g_thread_try_new ("avpool", gst_ffmpeg_pool_worker,
+        GUINT_TO_POINTER (shared_pool.generation), &err);
+    if (thread == NULL) {
+      GST_WARNING ("Failed to start shared pool worker: %s", err->message);
+      g_clear_error (&err);
+      /* don't try again for every batch */
+      shared_pool.max_workers = shared_pool.workers->len;
+      break;
+    }
+    g_ptr_array_add (shared_pool.workers, thread);
+  }
+}
+
+static void
+gst_ffmpeg_pool_execute_batch (GstFFMpegPoolBatch * batch)
+{
+  int n_slots = MAX (1, MIN (batch->avctx->thread_count, batch->count));
+  int i, jobnr, threadnr;
+
+  batch->free_slots = g_newa (int, n_slots);
+  for (i = 0; i < n_slots; i++)
+    batch->free_slots[i] = n_slots - 1 - i;
+  batch->n_free_slots = n_slots;
+  batch->next = batch->done = 0;
+  g_cond_init (&batch->cond);
+
+  g_mutex_lock (&shared_pool.lock);
+  gst_ffmpeg_pool_ensure_workers ();
+
+  g_queue_push_tail (&shared_pool.batches, batch);
+  if (n_slots > 1)
+    g_cond_broadcast (&shared_pool.work_cond);
+
+  while (batch->done < batch->count) {
+    if (gst_ffmpeg_pool_batch_claim (batch, &jobnr, &threadnr)) {
+      g_mutex_unlock (&shared_pool.lock);
+      gst_ffmpeg_pool_batch_run (batch, jobnr, threadnr);
+      g_mutex_lock (&shared_pool.lock);
+      gst_ffmpeg_pool_batch_release (batch, threadnr);
+    } else {
+      g_cond_wait (&batch->cond, &shared_pool.lock);
+    }
+  }
+  g_mutex_unlock (&shared_pool.lock);
+
+  g_cond_clear (&batch->cond);
+}
+
+static int
+gst_ffmpeg_pool_execute (AVCodecContext * c,
+    int (*func) (AVCodecContext * c2, void *arg2), void *arg, int *ret,
+    int count, int size)
+{
+  GstFFMpegPoolBatch batch = { 0, };
+
+  if (count <= 1 || c->thread_count <= 1 || shared_pool.max_workers == 0)
+    return avcodec_default_execute (c, func, arg, ret, count, size);
+
+  batch.avctx = c;
+  batch.func = func;
+  batch.arg = arg;
+  batch.ret = ret;
+  batch.count = count;
+  batch.size = size;
+  gst_ffmpeg_pool_execute_batch (&batch);
+
+  return 0;
+}
+
+static int
+gst_ffmpeg_pool_execute2 (AVCodecContext * c,
+    int (*func) (AVCodecContext * c2, void *arg2, int jobnr, int threadnr),
+    void *arg, int *ret, int count)
+{
+  GstFFMpegPoolBatch batch = { 0, };
+
+  if (count <= 1 || c->thread_count <= 1 || shared_pool.max_workers == 0)
+    return avcodec_default_execute2 (c, func, arg, ret, count);
+
+  batch.avctx = c;
+  batch.func2 = func;
+  batch.arg = arg;
+  batch.ret = ret;
+  batch.count = count;
+  gst_ffmpeg_pool_execute_batch (&batch);
+
+  return 0;
+}
+
+static void
+gst_ffmpeg_shared_pool_init (void)
+{
+  g_mutex_init (&shared_pool.lock);
+  g_cond_init (&shared_pool.work_cond);
+  g_queue_init (&shared_pool.batches);
+  shared_pool.workers = g_ptr_array_new ();
+
+  /* The threads are only started once a context actually uses the pool so
+   * that merely loading the plugin stays cheap. The calling threads help out
+   * with their own batches, hence one worker less than there are CPUs. */
+  shared_pool.max_workers = MAX (1, gst_ffmpeg_auto_max_threads () - 1);
+
+  GST_DEBUG ("shared worker pool with up to %u threads",
+      shared_pool.max_workers);
+}
+
+/* Stops the workers once the last context using the pool is closed */
+static void
+gst_ffmpeg_shared_pool_release (AVCodecContext * avctx)
+{
+  GPtrArray *workers = NULL;
+  guint i;
+
+  if (avctx->execute2 != gst_ffmpeg_pool_execute2)
+    return;
+
+  avctx->execute = avcodec_default_execute;
+  avctx->execute2 = avcodec_default_execute2;
+
+  g_mutex_lock (&shared_pool.lock);
+  if (--shared_pool.n_users == 0 && shared_pool.workers->len > 0) {
+    workers = shared_pool.workers;
+    shared_pool.workers = g_ptr_array_new ();
+    shared_pool.generation++;
+    g_cond_broadcast (&shared_pool.work_cond);
+  }
+  g_mutex_unlock (&shared_pool.lock);
+
+  if (workers == NULL)
+    return;
+
+  GST_DEBUG ("stopping %u shared pool workers", workers->len);
+  for (i = 0; i < workers->len; i++)
+    g_thread_join (g_ptr_array_index (workers, i));
+  g_ptr_array_free (workers, TRUE);
+}
+
+/*
+ * Open @avctx like gst_ffmpeg_avcodec_open(), then run its slice threading
+ * on the shared worker pool. libavcodec opens the context with the thread
+ * settings it asks for, so the codecs set up their slice threading and per
+ * thread data as usual, and only the execute()/execute2() hooks are replaced
+ * afterwards. The slice threads libavcodec started stay idle then. Contexts
+ * that don't end up with slice threading keep the default hooks. @shared is
+ * set to whether the pool is used.
+ */
+int
+gst_ffmpeg_avcodec_open_shared (AVCodecContext * avctx, AVCodec * codec,
+    gboolean * shared)
+{
+  int ret;
+
+  *shared = FALSE;
+
+  ret = gst_ffmpeg_avcodec_open (avctx, codec);
+  if (ret < 0 || shared_pool.max_workers == 0
+      || avctx->active_thread_type != FF_THREAD_SLICE
+      || avctx->thread_count <= 1)
+    return ret;
+
+  avctx->execute = gst_ffmpeg_pool_execute;
+  avctx->execute2 = gst_ffmpeg_pool_execute2;
+
+  g_mutex_lock (&shared_pool.lock);
+  shared_pool.n_users++;
+  g_mutex_unlock (&shared_pool.lock);
+
+  *shared = TRUE;
+
+  return ret;
+}
+
+/*
+ * Process-wide cache of opened codec contexts. Decoders that are stopped hand
+ * their context over instead of closing it, and a decoder that is about to
+ * open a context with the same key adopts it, skipping the allocation,
+ * avcodec_open2() and the thread setup. Contexts nobody adopted within their
+ * timeout are closed from a separate thread, the remaining ones when the
+ * plugin is finalized.
+ */
+#define CONTEXT_CACHE_MAX_ENTRIES 16
+
+typedef struct
+{
+  gchar *key;
+  AVCodecContext *context;
+  gint64 expire_time;
+} GstFFMpegCachedContext;
+
+static struct
+{
+  GMutex lock;
+  GCond cond;
+  GQueue entries;               /* oldest first */
+  GThread *thread;
+  gboolean shutdown;
+} context_cache;
+
+static void
+gst_ffmpeg_cached_context_free (GstFFMpegCachedContext * entry)
+{
+  GST_DEBUG ("closing cached context %p (%s)", entry->context, entry->key);
+
+  gst_ffmpeg_avcodec_close (entry->context);
+  avcodec_free_context (&entry->context);
+  g_free (entry->key);
+  g_slice_free (GstFFMpegCachedContext, entry);
+}
+
+static gpointer
+gst_ffmpeg_context_cache_expire (gpointer data)
+{
+  g_mutex_lock (&context_cache.lock);
+  while (!context_cache.shutdown) {
+    GstFFMpegCachedContext *entry;
+    gint64 expire_time = G_MAXINT64;
+    GList *l, *next;
+    GQueue expired = G_QUEUE_INIT;
+
+    for (l = context_cache.entries.head; l; l = next) {
+      entry = l->data;
+      next = l->next;
+
+      if (entry->expire_time <= g_get_monotonic_time ()) {
+        g_queue_delete_link (&context_cache.entries, l);
+        g_queue_push_tail (&expired, entry);
+      } else {
+        expire_time = MIN (expire_time, entry->expire_time);
+      }
+    }
+
+    if (!g_queue_is_empty (&expired)) {
+      /* closing can take a while, don't block the decoders meanwhile */
+      g_mutex_unlock (&context_cache.lock);
+      while ((entry = g_queue_pop_head (&expired)))
+        gst_ffmpeg_cached_context_free (entry);
+      g_mutex_lock (&context_cache.lock);
+      continue;
+    }
+
+    if (expire_time == G_MAXINT64)
+      g_cond_wait (&context_cache.cond, &context_cache.lock);
+    else
+      g_cond_wait_until (&context_cache.cond, &context_cache.lock,
+          expire_time);
+  }
+  g_mutex_unlock (&context_cache.lock);
+
+  return NULL;
+}
+
+/* Stops the expiry thread and closes the contexts still in the cache. Called
+ * when the plugin is finalized, from gst_deinit() */
+static void
+gst_ffmpeg_context_cache_deinit (gpointer data)
+{
+  GstFFMpegCachedContext *entry;
+  GThread *thread;
+
+  g_mutex_lock (&context_cache.lock);
+  context_cache.shutdown = TRUE;
+  thread = context_cache.thread;
+  context_cache.thread = NULL;
+  g_cond_signal (&context_cache.cond);
+  g_mutex_unlock (&context_cache.lock);
+
+  if (thread)
+    g_thread_join (thread);
+
+  while ((entry = g_queue_pop_head (&context_cache.entries)))
+    gst_ffmpeg_cached_context_free (entry);
+}
+
+/*
+ * Take over an opened context that is no longer used, keeping it open for
+ * @timeout_ms so that gst_ffmpeg_avcodec_cache_pop() can return it for @key.
+ * The context must be flushed, and must not refer to its previous user
+ * anymore. If the context can't be cached, it is closed and freed.
+ */
+void
+gst_ffmpeg_avcodec_cache_push (AVCodecContext * avctx, const gchar * key,
+    guint timeout_ms)
+{
+  GstFFMpegCachedContext *entry, *evicted = NULL;
+
+  entry = g_slice_new (GstFFMpegCachedContext);
+  entry->key = g_strdup (key);
+  entry->context = avctx;
+  entry->expire_time = g_get_monotonic_time () +
+      (gint64) timeout_ms * G_TIME_SPAN_MILLISECOND;
+
+  g_mutex_lock (&context_cache.lock);
+  if (context_cache.shutdown) {
+    g_mutex_unlock (&context_cache.lock);
+    gst_ffmpeg_cached_context_free (entry);
+    return;
+  }
+
+  if (context_cache.thread == NULL) {
+    GError *err = NULL;
+
+    context_cache.thread = g_thread_try_new ("avcache",
+        gst_ffmpeg_context_cache_expire, NULL, &err);
+    if (context_cache.thread == NULL) {
+      g_mutex_unlock (&context_cache.lock);
+      GST_WARNING ("Failed to start context cache thread: %s", err->message);
+      g_clear_error (&err);
+      gst_ffmpeg_cached_context_free (entry);
+      return;
+    }
+  }
+
+  if (g_queue_get_length (&context_cache.entries) >= CONTEXT_CACHE_MAX_ENTRIES)
+    evicted = g_queue_pop_head (&context_cache.entries);
+
+  GST_DEBUG ("caching context %p (%s) for %u ms", avctx, key, timeout_ms);
+  g_queue_push_tail (&context_cache.entries, entry);
+  g_cond_signal (&context_cache.cond);
+  g_mutex_unlock (&context_cache.lock);
+
+  if (evicted)
+    gst_ffmpeg_cached_context_free (evicted);
+}
+
+/*
+ * Returns the most recently cached context for @key, or NULL. The caller owns
+ * the opened context afterwards.
+ */
+AVCodecContext *
+gst_ffmpeg_avcodec_cache_pop (const gchar * key)
+{
+  AVCodecContext *avctx = NULL;
+  GList *l;
+
+  g_mutex_lock (&context_cache.lock);
+  for (l = context_cache.entries.tail; l; l = l->prev) {
+    GstFFMpegCachedContext *entry = l->data;
+
+    if (g_str_equal (entry->key, key)) {
+      g_queue_delete_link (&context_cache.entries, l);
+      avctx = entry->context;
+      g_free (entry->key);
+      g_slice_free (GstFFMpegCachedContext, entry);
+      break;
+    }
+  }
+  g_mutex_unlock (&context_cache.lock);
+
+  if (avctx)
+    GST_DEBUG ("reusing cached context %p (%s)", avctx, key);
+
+  return avctx;
+}
+
 #ifndef GST_DISABLE_GST_DEBUG
 static void
 gst_ffmpeg_log_callback (void *ptr, int level, const char *fmt, va_list vl)
@@ -169,6 +672,15 @@ plugin_init (GstPlugin * plugin)
 
   gst_ffmpeg_init_pix_fmt_info ();
 
+  gst_ffmpeg_shared_pool_init ();
+
+  g_mutex_init (&context_cache.lock);
+  g_cond_init (&context_cache.cond);
+  g_queue_init (&context_cache.entries);
+  /* the plugin is only finalized in gst_deinit() */
+  g_object_set_data_full (G_OBJECT (plugin), "gst-ffmpeg-context-cache",
+      &context_cache, gst_ffmpeg_context_cache_deinit);
+
   /* build global ffmpeg param/property info */
   gst_ffmpeg_cfg_init ();
 
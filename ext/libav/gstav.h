@@ -51,6 +51,11 @@ int gst_ffmpeg_avcodec_open (AVCodecContext *avctx, AVCodec *codec);
 int gst_ffmpeg_avcodec_open_sub (AVCodecContext *avctx, AVCodec *codec, AVDictionary *codec_opts);
 int gst_ffmpeg_avcodec_close (AVCodecContext *avctx);
 int gst_ffmpeg_av_find_stream_info(AVFormatContext *ic);
+int gst_ffmpeg_avcodec_open_shared (AVCodecContext *avctx, AVCodec *codec,
+    gboolean *shared);
+void gst_ffmpeg_avcodec_cache_push (AVCodecContext *avctx, const gchar *key,
+    guint timeout_ms);
+AVCodecContext *gst_ffmpeg_avcodec_cache_pop (const gchar *key);
 
 G_END_DECLS
 
@@ -34,15 +34,36 @@
 #include "gstav.h"
 #include "gstavcodecmap.h"
 #include "gstavutils.h"
+#include "gstavsamples.h"
 #include "gstavauddec.h"
 
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_PERFORMANCE);
 
+#define DEFAULT_CONTEXT_CACHE_TIME 0
+#define DEFAULT_STATS_INTERVAL 0
+#define DEFAULT_DIRECT_RENDERING TRUE
+
+/* alignment of the samples libav decodes into */
+#define DR_ALIGN 64
+
+enum
+{
+  PROP_0,
+  PROP_CONTEXT_CACHE_TIME,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_DIRECT_RENDERING,
+};
+
 /* A number of function prototypes are given so we can refer to them later. */
 static void gst_ffmpegauddec_base_init (GstFFMpegAudDecClass * klass);
 static void gst_ffmpegauddec_class_init (GstFFMpegAudDecClass * klass);
 static void gst_ffmpegauddec_init (GstFFMpegAudDec * ffmpegdec);
 static void gst_ffmpegauddec_finalize (GObject * object);
+static void gst_ffmpegauddec_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_ffmpegauddec_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
 static gboolean gst_ffmpegauddec_propose_allocation (GstAudioDecoder * decoder,
     GstQuery * query);
 
@@ -127,6 +148,28 @@ gst_ffmpegauddec_class_init (GstFFMpegAudDecClass * klass)
   parent_class = g_type_class_peek_parent (klass);
 
   gobject_class->finalize = gst_ffmpegauddec_finalize;
+  gobject_class->set_property = gst_ffmpegauddec_set_property;
+  gobject_class->get_property = gst_ffmpegauddec_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_CONTEXT_CACHE_TIME,
+      g_param_spec_uint ("context-cache-time", "Context cache time",
+          "Milliseconds to keep the codec open after stopping, for another "
+          "decoder with the same configuration to take over (0 = disabled)",
+          0, G_MAXUINT, DEFAULT_CONTEXT_CACHE_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Decoder performance counters since the decoder was started",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Statistics interval",
+          "Post the stats as element message every this many milliseconds "
+          "(0 = disabled)", 0, G_MAXUINT, DEFAULT_STATS_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_DIRECT_RENDERING,
+      g_param_spec_boolean ("direct-rendering", "Direct Rendering",
+          "Enable direct rendering", DEFAULT_DIRECT_RENDERING,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   gstaudiodecoder_class->start = GST_DEBUG_FUNCPTR (gst_ffmpegauddec_start);
   gstaudiodecoder_class->stop = GST_DEBUG_FUNCPTR (gst_ffmpegauddec_stop);
@@ -151,6 +194,10 @@ gst_ffmpegauddec_init (GstFFMpegAudDec * ffmpegdec)
   ffmpegdec->context = avcodec_alloc_context3 (klass->in_plugin);
   ffmpegdec->context->opaque = ffmpegdec;
   ffmpegdec->opened = FALSE;
+  ffmpegdec->context_cache_time = DEFAULT_CONTEXT_CACHE_TIME;
+  ffmpegdec->stats_interval = DEFAULT_STATS_INTERVAL;
+  ffmpegdec->stats_last_post = GST_CLOCK_TIME_NONE;
+  ffmpegdec->direct_rendering = DEFAULT_DIRECT_RENDERING;
 
   ffmpegdec->frame = av_frame_alloc ();
 
@@ -174,10 +221,163 @@ gst_ffmpegauddec_finalize (GObject * object)
     av_free (ffmpegdec->context);
     ffmpegdec->context = NULL;
   }
+  g_free (ffmpegdec->context_key);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
+static GstStructure *
+gst_ffmpegauddec_get_stats (GstFFMpegAudDec * ffmpegdec)
+{
+  GstStructure *stats;
+
+  stats = gst_structure_new ("avauddec-stats",
+      "frames-in", G_TYPE_UINT64, STATS_GET (ffmpegdec, frames_in),
+      "frames-out", G_TYPE_UINT64, STATS_GET (ffmpegdec, frames_out),
+      "packet-copies", G_TYPE_UINT64, STATS_GET (ffmpegdec, packet_copies),
+      "wrapped-frames", G_TYPE_UINT64, STATS_GET (ffmpegdec, wrapped_frames),
+      "dr-frames", G_TYPE_UINT64, STATS_GET (ffmpegdec, dr_frames),
+      "threads", G_TYPE_INT, ffmpegdec->context->thread_count, NULL);
+  gst_ffmpeg_stats_set_decode_time_histogram (stats,
+      ffmpegdec->stats.decode_time);
+
+  return stats;
+}
+
+/* Posts the stats as element message once per stats-interval */
+static void
+gst_ffmpegauddec_post_stats (GstFFMpegAudDec * ffmpegdec)
+{
+  GstClockTime now;
+
+  if (ffmpegdec->stats_interval == 0)
+    return;
+
+  now = gst_util_get_timestamp ();
+  if (GST_CLOCK_TIME_IS_VALID (ffmpegdec->stats_last_post) &&
+      now - ffmpegdec->stats_last_post <
+      ffmpegdec->stats_interval * GST_MSECOND)
+    return;
+
+  ffmpegdec->stats_last_post = now;
+  gst_element_post_message (GST_ELEMENT_CAST (ffmpegdec),
+      gst_message_new_element (GST_OBJECT_CAST (ffmpegdec),
+          gst_ffmpegauddec_get_stats (ffmpegdec)));
+}
+
+static void
+gst_ffmpegauddec_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec)
+{
+  GstFFMpegAudDec *ffmpegdec = (GstFFMpegAudDec *) object;
+
+  switch (prop_id) {
+    case PROP_CONTEXT_CACHE_TIME:
+      ffmpegdec->context_cache_time = g_value_get_uint (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      ffmpegdec->stats_interval = g_value_get_uint (value);
+      break;
+    case PROP_DIRECT_RENDERING:
+      ffmpegdec->direct_rendering = g_value_get_boolean (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_ffmpegauddec_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec)
+{
+  GstFFMpegAudDec *ffmpegdec = (GstFFMpegAudDec *) object;
+
+  switch (prop_id) {
+    case PROP_CONTEXT_CACHE_TIME:
+      g_value_set_uint (value, ffmpegdec->context_cache_time);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_ffmpegauddec_get_stats (ffmpegdec));
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, ffmpegdec->stats_interval);
+      break;
+    case PROP_DIRECT_RENDERING:
+      g_value_set_boolean (value, ffmpegdec->direct_rendering);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+/* Take over an opened context that another instance left in the cache
+ * instead of opening the one configured for @caps. With LOCK */
+static gboolean
+gst_ffmpegauddec_adopt_cached_context (GstFFMpegAudDec * ffmpegdec,
+    GstCaps * caps)
+{
+  GstFFMpegAudDecClass *oclass;
+  AVCodecContext *context;
+  gchar *caps_str;
+
+  oclass = (GstFFMpegAudDecClass *) (G_OBJECT_GET_CLASS (ffmpegdec));
+
+  g_free (ffmpegdec->context_key);
+  ffmpegdec->context_key = NULL;
+
+  if (ffmpegdec->context_cache_time == 0)
+    return FALSE;
+
+  /* audio codecs take everything from the caps when opening */
+  caps_str = gst_caps_to_string (caps);
+  ffmpegdec->context_key = g_strdup_printf ("%s:%s", oclass->in_plugin->name,
+      caps_str);
+  g_free (caps_str);
+
+  context = gst_ffmpeg_avcodec_cache_pop (ffmpegdec->context_key);
+  if (context == NULL)
+    return FALSE;
+
+  context->get_buffer2 = ffmpegdec->context->get_buffer2;
+  avcodec_free_context (&ffmpegdec->context);
+  ffmpegdec->context = context;
+  context->opaque = ffmpegdec;
+
+  ffmpegdec->opened = TRUE;
+  gst_audio_info_init (&ffmpegdec->info);
+
+  GST_DEBUG_OBJECT (ffmpegdec, "adopted cached codec context %p", context);
+
+  return TRUE;
+}
+
+/* Hand the opened context over to the cache, leaving a fresh one behind.
+ * With LOCK */
+static void
+gst_ffmpegauddec_cache_context (GstFFMpegAudDec * ffmpegdec)
+{
+  GstFFMpegAudDecClass *oclass;
+
+  oclass = (GstFFMpegAudDecClass *) (G_OBJECT_GET_CLASS (ffmpegdec));
+
+  if (!ffmpegdec->opened || ffmpegdec->context_cache_time == 0 ||
+      ffmpegdec->context_key == NULL)
+    return;
+
+  avcodec_flush_buffers (ffmpegdec->context);
+  av_frame_unref (ffmpegdec->frame);
+
+  ffmpegdec->context->opaque = NULL;
+  gst_ffmpeg_avcodec_cache_push (ffmpegdec->context, ffmpegdec->context_key,
+      ffmpegdec->context_cache_time);
+
+  ffmpegdec->context = avcodec_alloc_context3 (oclass->in_plugin);
+  ffmpegdec->context->opaque = ffmpegdec;
+  ffmpegdec->opened = FALSE;
+}
+
 /* With LOCK */
 static gboolean
 gst_ffmpegauddec_close (GstFFMpegAudDec * ffmpegdec, gboolean reset)
@@ -226,6 +426,8 @@ gst_ffmpegauddec_start (GstAudioDecoder * decoder)
     return FALSE;
   }
   ffmpegdec->context->opaque = ffmpegdec;
+  memset (&ffmpegdec->stats, 0, sizeof (ffmpegdec->stats));
+  ffmpegdec->stats_last_post = GST_CLOCK_TIME_NONE;
   GST_OBJECT_UNLOCK (ffmpegdec);
 
   return TRUE;
@@ -237,10 +439,8 @@ gst_ffmpegauddec_stop (GstAudioDecoder * decoder)
   GstFFMpegAudDec *ffmpegdec = (GstFFMpegAudDec *) decoder;
 
   GST_OBJECT_LOCK (ffmpegdec);
+  gst_ffmpegauddec_cache_context (ffmpegdec);
   gst_ffmpegauddec_close (ffmpegdec, FALSE);
-  g_free (ffmpegdec->padded);
-  ffmpegdec->padded = NULL;
-  ffmpegdec->padded_size = 0;
   GST_OBJECT_UNLOCK (ffmpegdec);
   gst_audio_info_init (&ffmpegdec->info);
   gst_caps_replace (&ffmpegdec->last_caps, NULL);
@@ -278,6 +478,89 @@ could_not_open:
   }
 }
 
+/* A buffer from downstream that libav decodes into, mapped until libav
+ * releases it */
+typedef struct
+{
+  GstBuffer *buffer;
+  GstMapInfo map;
+} GstFFMpegAudDecDRBuffer;
+
+static void
+gst_ffmpegauddec_dr_buffer_free (void *opaque, uint8_t * data)
+{
+  GstFFMpegAudDecDRBuffer *dr = opaque;
+
+  gst_buffer_unmap (dr->buffer, &dr->map);
+  gst_buffer_unref (dr->buffer);
+  g_slice_free (GstFFMpegAudDecDRBuffer, dr);
+}
+
+/* called when libav wants us to allocate the samples of a frame. They are
+ * decoded into a buffer from the negotiated allocator, laid out like libav
+ * does it itself */
+static int
+gst_ffmpegauddec_get_buffer2 (AVCodecContext * context, AVFrame * frame,
+    int flags)
+{
+  GstFFMpegAudDec *ffmpegdec = (GstFFMpegAudDec *) context->opaque;
+  GstFFMpegAudDecDRBuffer *dr;
+  gint channels, planes, size;
+  guint8 *data;
+
+  if (!ffmpegdec->direct_rendering)
+    goto fallback;
+
+  channels = frame->channels;
+  planes = av_sample_fmt_is_planar (frame->format) ? channels : 1;
+  /* more planes need extended_data, keep that to libav */
+  if (channels <= 0 || planes > AV_NUM_DATA_POINTERS)
+    goto fallback;
+
+  size = av_samples_get_buffer_size (NULL, channels, frame->nb_samples,
+      frame->format, DR_ALIGN);
+  if (size < 0)
+    goto fallback;
+
+  dr = g_slice_new0 (GstFFMpegAudDecDRBuffer);
+  dr->buffer =
+      gst_audio_decoder_allocate_output_buffer (GST_AUDIO_DECODER (ffmpegdec),
+      size + DR_ALIGN - 1);
+  if (dr->buffer == NULL)
+    goto alloc_failed;
+  if (!gst_buffer_map (dr->buffer, &dr->map, GST_MAP_READWRITE)) {
+    gst_buffer_unref (dr->buffer);
+    goto alloc_failed;
+  }
+
+  data = GSIZE_TO_POINTER (GST_ROUND_UP_64 (GPOINTER_TO_SIZE (dr->map.data)));
+  frame->buf[0] = av_buffer_create (data, size,
+      gst_ffmpegauddec_dr_buffer_free, dr, 0);
+  if (frame->buf[0] == NULL) {
+    gst_ffmpegauddec_dr_buffer_free (dr, NULL);
+    goto fallback;
+  }
+
+  av_samples_fill_arrays (frame->data, &frame->linesize[0], data, channels,
+      frame->nb_samples, frame->format, DR_ALIGN);
+  frame->extended_data = frame->data;
+  frame->opaque = dr;
+
+  return 0;
+
+alloc_failed:
+  {
+    GST_CAT_TRACE_OBJECT (GST_CAT_PERFORMANCE, ffmpegdec,
+        "could not get a mapped output buffer, libav allocates");
+    g_slice_free (GstFFMpegAudDecDRBuffer, dr);
+    goto fallback;
+  }
+fallback:
+  {
+    return avcodec_default_get_buffer2 (context, frame, flags);
+  }
+}
+
 static gboolean
 gst_ffmpegauddec_propose_allocation (GstAudioDecoder * decoder,
     GstQuery * query)
@@ -336,10 +619,15 @@ gst_ffmpegauddec_set_format (GstAudioDecoder * decoder, GstCaps * caps)
   ffmpegdec->context->workaround_bugs |= FF_BUG_AUTODETECT;
   ffmpegdec->context->err_recognition = 1;
 
+  /* libav may allocate frames while opening already */
+  if (oclass->in_plugin->capabilities & AV_CODEC_CAP_DR1)
+    ffmpegdec->context->get_buffer2 = gst_ffmpegauddec_get_buffer2;
+
   /* open codec - we don't select an output pix_fmt yet,
    * simply because we don't know! We only get it
    * during playback... */
-  if (!gst_ffmpegauddec_open (ffmpegdec))
+  if (!gst_ffmpegauddec_adopt_cached_context (ffmpegdec, caps) &&
+      !gst_ffmpegauddec_open (ffmpegdec))
     goto open_failed;
 
 done:
@@ -414,6 +702,14 @@ gst_ffmpegauddec_negotiate (GstFFMpegAudDec * ffmpegdec,
   gst_audio_channel_positions_to_valid_order (pos, channels);
   ffmpegdec->needs_reorder =
       memcmp (pos, ffmpegdec->ffmpeg_layout, sizeof (pos[0]) * channels) != 0;
+  if (!ffmpegdec->needs_reorder || !gst_audio_get_channel_reorder_map (channels,
+          ffmpegdec->ffmpeg_layout, pos, ffmpegdec->reorder_map)) {
+    gint i;
+
+    ffmpegdec->needs_reorder = FALSE;
+    for (i = 0; i < channels; i++)
+      ffmpegdec->reorder_map[i] = i;
+  }
   gst_audio_info_set_format (&ffmpegdec->info, format,
       frame->sample_rate, channels, pos);
   ffmpegdec->info.layout = layout;
@@ -457,11 +753,95 @@ caps_failed:
 }
 
 static void
-gst_avpacket_init (AVPacket * packet, guint8 * data, guint size)
+gst_ffmpegauddec_avbuffer_unref (gpointer data)
+{
+  AVBufferRef *avbuffer = data;
+
+  av_buffer_unref (&avbuffer);
+}
+
+/* Wrap the samples of the current frame in a GstBuffer without copying: one
+ * memory per channel plane, described by a GstAudioMeta, or a single memory
+ * for interleaved samples. Every memory holds a reference on the AVBufferRef
+ * backing it. Returns NULL if a plane can't be wrapped. */
+static GstBuffer *
+gst_ffmpegauddec_wrap_output_buffer (GstFFMpegAudDec * ffmpegdec,
+    gsize plane_size, gint n_planes)
+{
+  AVFrame *frame = ffmpegdec->frame;
+  GstBuffer *buffer;
+  gint i;
+
+  /* linesize is the padded size of every plane */
+  if (frame->linesize[0] < 0 || plane_size > (gsize) frame->linesize[0])
+    return NULL;
+
+  buffer = gst_buffer_new ();
+
+  for (i = 0; i < n_planes; i++) {
+    AVBufferRef *avbuffer;
+    guint8 *data = frame->extended_data[i];
+
+    avbuffer = av_frame_get_plane_buffer (frame, i);
+    if (data == NULL || avbuffer == NULL || data + plane_size >
+        avbuffer->data + avbuffer->size)
+      goto no_wrap;
+
+    avbuffer = av_buffer_ref (avbuffer);
+    if (avbuffer == NULL)
+      goto no_wrap;
+
+    gst_buffer_append_memory (buffer,
+        gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY, data, plane_size,
+            0, plane_size, avbuffer, gst_ffmpegauddec_avbuffer_unref));
+  }
+
+  /* the planes follow each other in the buffer, which are the default
+   * offsets */
+  if (ffmpegdec->info.layout == GST_AUDIO_LAYOUT_NON_INTERLEAVED)
+    gst_buffer_add_audio_meta (buffer, &ffmpegdec->info, frame->nb_samples,
+        NULL);
+
+  return buffer;
+
+no_wrap:
+  {
+    GST_CAT_TRACE_OBJECT (GST_CAT_PERFORMANCE, ffmpegdec,
+        "plane %d can't be wrapped, copying", i);
+    gst_buffer_unref (buffer);
+    return NULL;
+  }
+}
+
+/* The samples of the current frame were decoded into a buffer from
+ * gst_ffmpegauddec_get_buffer2(), output the part of it they cover.
+ * Returns NULL if libav allocated the frame itself */
+static GstBuffer *
+gst_ffmpegauddec_dr_output_buffer (GstFFMpegAudDec * ffmpegdec,
+    gsize plane_size, gint n_planes)
 {
-  memset (packet, 0, sizeof (AVPacket));
-  packet->data = data;
-  packet->size = size;
+  AVFrame *frame = ffmpegdec->frame;
+  GstFFMpegAudDecDRBuffer *dr = frame->opaque;
+  gsize offsets[AV_NUM_DATA_POINTERS];
+  GstBuffer *buffer;
+  gint i;
+
+  if (dr == NULL || frame->buf[0] == NULL
+      || av_buffer_get_opaque (frame->buf[0]) != dr)
+    return NULL;
+
+  for (i = 0; i < n_planes; i++)
+    offsets[i] = frame->extended_data[i] - frame->extended_data[0];
+
+  buffer = gst_buffer_copy_region (dr->buffer, GST_BUFFER_COPY_MEMORY,
+      frame->extended_data[0] - dr->map.data,
+      offsets[n_planes - 1] + plane_size);
+
+  if (ffmpegdec->info.layout == GST_AUDIO_LAYOUT_NON_INTERLEAVED)
+    gst_buffer_add_audio_meta (buffer, &ffmpegdec->info, frame->nb_samples,
+        offsets);
+
+  return buffer;
 }
 
 /*
@@ -504,36 +884,67 @@ gst_ffmpegauddec_audio_frame (GstFFMpegAudDec * ffmpegdec,
     /* ffmpegdec->frame->linesize[0] might contain padding, allocate only what's needed */
     output_size = nsamples * byte_per_sample * channels;
 
-    *outbuf =
-        gst_audio_decoder_allocate_output_buffer (GST_AUDIO_DECODER
-        (ffmpegdec), output_size);
+    /* channels are reordered while copying */
+    *outbuf = NULL;
+    if (!ffmpegdec->needs_reorder) {
+      gsize plane_size = planar ? nsamples * byte_per_sample : output_size;
+      gint n_planes = planar ? channels : 1;
+
+      *outbuf = gst_ffmpegauddec_dr_output_buffer (ffmpegdec, plane_size,
+          n_planes);
+      if (*outbuf) {
+        STATS_INC (ffmpegdec, dr_frames);
+      } else {
+        *outbuf = gst_ffmpegauddec_wrap_output_buffer (ffmpegdec, plane_size,
+            n_planes);
+        if (*outbuf)
+          STATS_INC (ffmpegdec, wrapped_frames);
+      }
+    }
 
-    if (planar) {
+    if (*outbuf == NULL && planar) {
       gint i;
       GstAudioMeta *meta;
 
+      *outbuf =
+          gst_audio_decoder_allocate_output_buffer (GST_AUDIO_DECODER
+          (ffmpegdec), output_size);
       meta = gst_buffer_add_audio_meta (*outbuf, &ffmpegdec->info, nsamples,
           NULL);
 
+      /* every plane goes straight to its GStreamer channel */
       for (i = 0; i < channels; i++) {
-        gst_buffer_fill (*outbuf, meta->offsets[i],
+        gst_buffer_fill (*outbuf, meta->offsets[ffmpegdec->reorder_map[i]],
             ffmpegdec->frame->extended_data[i], nsamples * byte_per_sample);
       }
-    } else {
+    } else if (*outbuf == NULL && ffmpegdec->needs_reorder) {
+      GstMapInfo map;
+
+      *outbuf =
+          gst_audio_decoder_allocate_output_buffer (GST_AUDIO_DECODER
+          (ffmpegdec), output_size);
+      if (!gst_buffer_map (*outbuf, &map, GST_MAP_WRITE)) {
+        GST_ELEMENT_ERROR (ffmpegdec, STREAM, DECODE, ("Decoding problem"),
+            ("Failed to map output buffer for writing"));
+        gst_buffer_unref (*outbuf);
+        *outbuf = NULL;
+        *ret = GST_FLOW_ERROR;
+        got_frame = FALSE;
+        goto beach;
+      }
+      gst_ffmpeg_reorder_interleaved (map.data, ffmpegdec->frame->data[0],
+          nsamples, channels, byte_per_sample, ffmpegdec->reorder_map);
+      gst_buffer_unmap (*outbuf, &map);
+    } else if (*outbuf == NULL) {
+      *outbuf =
+          gst_audio_decoder_allocate_output_buffer (GST_AUDIO_DECODER
+          (ffmpegdec), output_size);
       gst_buffer_fill (*outbuf, 0, ffmpegdec->frame->data[0], output_size);
     }
 
     GST_DEBUG_OBJECT (ffmpegdec, "Buffer created. Size: %" G_GSIZE_FORMAT,
         output_size);
 
-    /* Reorder channels to the GStreamer channel order */
-    if (ffmpegdec->needs_reorder) {
-      *outbuf = gst_buffer_make_writable (*outbuf);
-      gst_audio_buffer_reorder_channels (*outbuf, ffmpegdec->info.finfo->format,
-          ffmpegdec->info.channels, ffmpegdec->ffmpeg_layout,
-          ffmpegdec->info.position);
-    }
-
     /* Mark corrupted frames as corrupted */
     if (ffmpegdec->frame->flags & AV_FRAME_FLAG_CORRUPT)
       GST_BUFFER_FLAG_SET (*outbuf, GST_BUFFER_FLAG_CORRUPTED);
@@ -577,6 +988,7 @@ gst_ffmpegauddec_frame (GstFFMpegAudDec * ffmpegdec, GstFlowReturn * ret)
 
   if (outbuf) {
     GST_LOG_OBJECT (ffmpegdec, "Decoded data, buffer %" GST_PTR_FORMAT, outbuf);
+    STATS_INC (ffmpegdec, frames_out);
     *ret =
         gst_audio_decoder_finish_subframe (GST_AUDIO_DECODER_CAST (ffmpegdec),
         outbuf);
@@ -651,13 +1063,12 @@ gst_ffmpegauddec_handle_frame (GstAudioDecoder * decoder, GstBuffer * inbuf)
 {
   GstFFMpegAudDec *ffmpegdec;
   GstFFMpegAudDecClass *oclass;
-  guint8 *data;
-  GstMapInfo map;
-  gint size;
+  gboolean copied;
   gboolean got_any_frames = FALSE;
   gboolean got_frame;
   GstFlowReturn ret = GST_FLOW_OK;
   gboolean is_header;
+  GstClockTime start;
   AVPacket packet;
 
   ffmpegdec = (GstFFMpegAudDec *) decoder;
@@ -690,33 +1101,22 @@ gst_ffmpegauddec_handle_frame (GstAudioDecoder * decoder, GstBuffer * inbuf)
     inbuf = gst_buffer_make_writable (inbuf);
   }
 
-  gst_buffer_map (inbuf, &map, GST_MAP_READ);
-
-  data = map.data;
-  size = map.size;
+  /* hand the input memory to libav as a refcounted packet, so that it
+   * doesn't make its own copy */
+  if (!gst_ffmpeg_avpacket_from_buffer (&packet, inbuf, &copied))
+    goto map_failed;
 
-  if (size > 0 && (!GST_MEMORY_IS_ZERO_PADDED (map.memory)
-          || (map.maxsize - map.size) < AV_INPUT_BUFFER_PADDING_SIZE)) {
-    /* add padding */
-    if (ffmpegdec->padded_size < size + AV_INPUT_BUFFER_PADDING_SIZE) {
-      ffmpegdec->padded_size = size + AV_INPUT_BUFFER_PADDING_SIZE;
-      ffmpegdec->padded = g_realloc (ffmpegdec->padded, ffmpegdec->padded_size);
-      GST_LOG_OBJECT (ffmpegdec, "resized padding buffer to %d",
-          ffmpegdec->padded_size);
-    }
+  STATS_INC (ffmpegdec, frames_in);
+  if (copied) {
     GST_CAT_TRACE_OBJECT (GST_CAT_PERFORMANCE, ffmpegdec,
         "Copy input to add padding");
-    memcpy (ffmpegdec->padded, data, size);
-    memset (ffmpegdec->padded + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
-
-    data = ffmpegdec->padded;
+    STATS_INC (ffmpegdec, packet_copies);
   }
 
-  gst_avpacket_init (&packet, data, size);
-
   if (!packet.size)
     goto unmap;
 
+  start = gst_util_get_timestamp ();
   if (avcodec_send_packet (ffmpegdec->context, &packet) < 0) {
     goto send_packet_failed;
   }
@@ -736,6 +1136,10 @@ gst_ffmpegauddec_handle_frame (GstAudioDecoder * decoder, GstBuffer * inbuf)
     }
   } while (got_frame);
 
+  gst_ffmpeg_decode_time_histogram_add (ffmpegdec->stats.decode_time,
+      gst_util_get_timestamp () - start);
+  gst_ffmpegauddec_post_stats (ffmpegdec);
+
   if (is_header || got_any_frames) {
     /* Even if previous return wasn't GST_FLOW_OK, we need to call
      * _finish_frame() since baseclass is expecting that _finish_frame()
@@ -752,7 +1156,7 @@ gst_ffmpegauddec_handle_frame (GstAudioDecoder * decoder, GstBuffer * inbuf)
   }
 
 unmap:
-  gst_buffer_unmap (inbuf, &map);
+  av_packet_unref (&packet);
   gst_buffer_unref (inbuf);
 
 done:
@@ -769,6 +1173,15 @@ not_negotiated:
     goto done;
   }
 
+map_failed:
+  {
+    GST_ELEMENT_ERROR (ffmpegdec, STREAM, DECODE, ("Decoding problem"),
+        ("Failed to map buffer for reading"));
+    gst_buffer_unref (inbuf);
+    ret = GST_FLOW_ERROR;
+    goto done;
+  }
+
 send_packet_failed:
   {
     GST_WARNING_OBJECT (ffmpegdec, "decoding error");
@@ -27,6 +27,19 @@ G_BEGIN_DECLS
 #include <gst/audio/audio.h>
 #include <libavcodec/avcodec.h>
 
+#include "gstavutils.h"
+
+/* performance counters since start(), reported through the stats property */
+typedef struct
+{
+  guint frames_in;
+  guint frames_out;
+  guint packet_copies;
+  guint wrapped_frames;
+  guint dr_frames;
+  guint decode_time[GST_FFMPEG_DECODE_TIME_BUCKETS];
+} GstFFMpegAudDecStats;
+
 typedef struct _GstFFMpegAudDec GstFFMpegAudDec;
 struct _GstFFMpegAudDec
 {
@@ -38,9 +51,6 @@ struct _GstFFMpegAudDec
 
   AVFrame *frame;
 
-  guint8 *padded;
-  gint padded_size;
-
   /* prevent reopening the decoder on GST_EVENT_CAPS when caps are same as last time. */
   GstCaps *last_caps;
 
@@ -48,6 +58,19 @@ struct _GstFFMpegAudDec
   GstAudioInfo info;
   GstAudioChannelPosition ffmpeg_layout[64];
   gboolean needs_reorder;
+  /* channel i of libav is channel reorder_map[i] of info */
+  gint reorder_map[64];
+
+  gboolean direct_rendering;
+
+  /* opened contexts are left in the process-wide cache on stop() for this
+   * long, under context_key */
+  guint context_cache_time;
+  gchar *context_key;
+
+  GstFFMpegAudDecStats stats;
+  guint stats_interval;
+  GstClockTime stats_last_post;
 };
 
 typedef struct _GstFFMpegAudDecClass GstFFMpegAudDecClass;
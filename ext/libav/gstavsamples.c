@@ -0,0 +1,244 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Sample copying kernels. The SIMD versions are built with function target
+ * attributes and selected at runtime from the libavutil cpu flags, so they
+ * don't need any special compiler flags for the whole plugin. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <libavutil/cpu.h>
+
+#include "gstavsamples.h"
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#elif defined (__GNUC__) && defined (__aarch64__)
+#define HAVE_NEON_KERNELS 1
+#include <arm_neon.h>
+#endif
+
+/* frames of up to this many bytes are reordered with byte shuffles */
+#define REORDER_MAX_SHUFFLE_FRAME 32
+
+static void
+reorder_interleaved_c (guint8 * dest, const guint8 * src, gint n_frames,
+    gint channels, gint bps, const gint * reorder_map)
+{
+  gint i, c;
+
+  switch (bps) {
+    case 2:{
+      const guint16 *s = (const guint16 *) src;
+      guint16 *d = (guint16 *) dest;
+
+      for (i = 0; i < n_frames; i++, s += channels, d += channels)
+        for (c = 0; c < channels; c++)
+          d[reorder_map[c]] = s[c];
+      break;
+    }
+    case 4:{
+      const guint32 *s = (const guint32 *) src;
+      guint32 *d = (guint32 *) dest;
+
+      for (i = 0; i < n_frames; i++, s += channels, d += channels)
+        for (c = 0; c < channels; c++)
+          d[reorder_map[c]] = s[c];
+      break;
+    }
+    case 8:{
+      const guint64 *s = (const guint64 *) src;
+      guint64 *d = (guint64 *) dest;
+
+      for (i = 0; i < n_frames; i++, s += channels, d += channels)
+        for (c = 0; c < channels; c++)
+          d[reorder_map[c]] = s[c];
+      break;
+    }
+    default:
+      for (i = 0; i < n_frames; i++, src += channels * bps,
+          dest += channels * bps)
+        for (c = 0; c < channels; c++)
+          memcpy (dest + reorder_map[c] * bps, src + c * bps, bps);
+      break;
+  }
+}
+
+/* The shuffle kernels read and write whole vectors starting at every frame.
+ * What they write past the end of a frame is overwritten with the right
+ * samples by the next frame, so they stop as soon as a vector would go past
+ * the last frame and leave the rest to reorder_interleaved_c().
+ * @mask gives the source byte of every destination byte of a frame, 0x80
+ * past its end. They return the number of frames done. */
+
+#ifdef HAVE_X86_KERNELS
+__attribute__ ((target ("ssse3")))
+static gint
+reorder_interleaved_ssse3 (guint8 * dest, const guint8 * src, gint n_frames,
+    gint frame_size, const guint8 * mask)
+{
+  gsize total = (gsize) n_frames * frame_size;
+  gint i = 0;
+
+  if (frame_size <= 16) {
+    __m128i m = _mm_loadu_si128 ((const __m128i *) mask);
+
+    for (; (gsize) i * frame_size + 16 <= total; i++) {
+      gsize off = (gsize) i * frame_size;
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (src + off));
+
+      _mm_storeu_si128 ((__m128i *) (dest + off), _mm_shuffle_epi8 (v, m));
+    }
+  } else {
+    guint8 m[4][16];
+    __m128i m00, m01, m10, m11;
+    gint j;
+
+    /* pshufb only looks at one register, pick each destination byte from
+     * the first or from the second half of the frame */
+    for (j = 0; j < 32; j++) {
+      guint8 idx = mask[j];
+
+      m[(j / 16) * 2][j % 16] = idx < 16 ? idx : 0x80;
+      m[(j / 16) * 2 + 1][j % 16] = idx >= 16 && idx < 32 ? idx - 16 : 0x80;
+    }
+    m00 = _mm_loadu_si128 ((const __m128i *) m[0]);
+    m01 = _mm_loadu_si128 ((const __m128i *) m[1]);
+    m10 = _mm_loadu_si128 ((const __m128i *) m[2]);
+    m11 = _mm_loadu_si128 ((const __m128i *) m[3]);
+
+    for (; (gsize) i * frame_size + 32 <= total; i++) {
+      gsize off = (gsize) i * frame_size;
+      __m128i lo = _mm_loadu_si128 ((const __m128i *) (src + off));
+      __m128i hi = _mm_loadu_si128 ((const __m128i *) (src + off + 16));
+
+      _mm_storeu_si128 ((__m128i *) (dest + off),
+          _mm_or_si128 (_mm_shuffle_epi8 (lo, m00),
+              _mm_shuffle_epi8 (hi, m01)));
+      _mm_storeu_si128 ((__m128i *) (dest + off + 16),
+          _mm_or_si128 (_mm_shuffle_epi8 (lo, m10),
+              _mm_shuffle_epi8 (hi, m11)));
+    }
+  }
+
+  return i;
+}
+
+/* 32 bit samples, up to 8 channels: one frame per permutation */
+__attribute__ ((target ("avx2")))
+static gint
+reorder_interleaved_avx2 (guint8 * dest, const guint8 * src, gint n_frames,
+    gint channels, const gint * inv_map)
+{
+  gsize total = (gsize) n_frames * channels * 4;
+  gint idx[8];
+  __m256i perm;
+  gint i;
+
+  for (i = 0; i < 8; i++)
+    idx[i] = i < channels ? inv_map[i] : i;
+  perm = _mm256_loadu_si256 ((const __m256i *) idx);
+
+  for (i = 0; (gsize) i * channels * 4 + 32 <= total; i++) {
+    gsize off = (gsize) i * channels * 4;
+    __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + off));
+
+    _mm256_storeu_si256 ((__m256i *) (dest + off),
+        _mm256_permutevar8x32_epi32 (v, perm));
+  }
+
+  return i;
+}
+#endif
+
+#ifdef HAVE_NEON_KERNELS
+static gint
+reorder_interleaved_neon (guint8 * dest, const guint8 * src, gint n_frames,
+    gint frame_size, const guint8 * mask)
+{
+  gsize total = (gsize) n_frames * frame_size;
+  gint i = 0;
+
+  if (frame_size <= 16) {
+    uint8x16_t m = vld1q_u8 (mask);
+
+    for (; (gsize) i * frame_size + 16 <= total; i++) {
+      gsize off = (gsize) i * frame_size;
+
+      vst1q_u8 (dest + off, vqtbl1q_u8 (vld1q_u8 (src + off), m));
+    }
+  } else {
+    uint8x16_t m0 = vld1q_u8 (mask);
+    uint8x16_t m1 = vld1q_u8 (mask + 16);
+
+    for (; (gsize) i * frame_size + 32 <= total; i++) {
+      gsize off = (gsize) i * frame_size;
+      uint8x16x2_t v;
+
+      v.val[0] = vld1q_u8 (src + off);
+      v.val[1] = vld1q_u8 (src + off + 16);
+      vst1q_u8 (dest + off, vqtbl2q_u8 (v, m0));
+      vst1q_u8 (dest + off + 16, vqtbl2q_u8 (v, m1));
+    }
+  }
+
+  return i;
+}
+#endif
+
+void
+gst_ffmpeg_reorder_interleaved (guint8 * dest, const guint8 * src,
+    gint n_frames, gint channels, gint bps, const gint * reorder_map)
+{
+  gint frame_size = channels * bps;
+  gint done = 0;
+
+#if defined (HAVE_X86_KERNELS) || defined (HAVE_NEON_KERNELS)
+  /* covers 5.1 and 7.1 in 16 and 32 bit */
+  if (frame_size <= REORDER_MAX_SHUFFLE_FRAME) {
+    gint inv_map[REORDER_MAX_SHUFFLE_FRAME];
+    guint8 mask[REORDER_MAX_SHUFFLE_FRAME];
+    gint flags = av_get_cpu_flags ();
+    gint c, j;
+
+    for (c = 0; c < channels; c++)
+      inv_map[reorder_map[c]] = c;
+    for (j = 0; j < REORDER_MAX_SHUFFLE_FRAME; j++)
+      mask[j] = j < frame_size ? inv_map[j / bps] * bps + j % bps : 0x80;
+
+#ifdef HAVE_X86_KERNELS
+    if (bps == 4 && (flags & AV_CPU_FLAG_AVX2))
+      done = reorder_interleaved_avx2 (dest, src, n_frames, channels, inv_map);
+    else if (flags & AV_CPU_FLAG_SSSE3)
+      done = reorder_interleaved_ssse3 (dest, src, n_frames, frame_size, mask);
+#else
+    if (flags & AV_CPU_FLAG_NEON)
+      done = reorder_interleaved_neon (dest, src, n_frames, frame_size, mask);
+#endif
+  }
+#endif
+
+  reorder_interleaved_c (dest + (gsize) done * frame_size,
+      src + (gsize) done * frame_size, n_frames - done, channels, bps,
+      reorder_map);
+}
@@ -0,0 +1,38 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_FFMPEG_SAMPLES_H__
+#define __GST_FFMPEG_SAMPLES_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Copy @n_frames interleaved frames of @channels samples of @bps bytes from
+ * @src to @dest, moving channel i to channel @reorder_map[i], as returned by
+ * gst_audio_get_channel_reorder_map().
+ */
+void
+gst_ffmpeg_reorder_interleaved (guint8 * dest, const guint8 * src,
+                                gint n_frames, gint channels, gint bps,
+                                const gint * reorder_map);
+
+G_END_DECLS
+
+#endif /* __GST_FFMPEG_SAMPLES_H__ */
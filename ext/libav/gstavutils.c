@@ -31,6 +31,8 @@
 #include <stdlib.h>
 #endif
 
+#include <string.h>
+
 #include <libavutil/mem.h>
 
 const gchar *
@@ -493,3 +495,120 @@ gst_ffmpeg_auto_max_threads (void)
 
   return (int) (n_threads);
 }
+
+typedef struct
+{
+  GstBuffer *buffer;
+  GstMapInfo map;
+} GstFFMpegPacketBuffer;
+
+static void
+gst_ffmpeg_packet_buffer_free (void *opaque, uint8_t * data)
+{
+  GstFFMpegPacketBuffer *pbuf = opaque;
+
+  gst_buffer_unmap (pbuf->buffer, &pbuf->map);
+  gst_buffer_unref (pbuf->buffer);
+  g_slice_free (GstFFMpegPacketBuffer, pbuf);
+}
+
+/*
+ * Fill in a refcounted AVPacket with the contents of @buffer.
+ *
+ * When the buffer memory carries the zero padding libav requires, the packet
+ * references the mapped memory directly and keeps @buffer mapped and alive
+ * until libav releases it. Otherwise the data is copied once into a padded
+ * packet and @copied is set.
+ *
+ * The packet must be released with av_packet_unref().
+ */
+gboolean
+gst_ffmpeg_avpacket_from_buffer (AVPacket * packet, GstBuffer * buffer,
+    gboolean * copied)
+{
+  GstFFMpegPacketBuffer *pbuf;
+
+  memset (packet, 0, sizeof (AVPacket));
+  *copied = FALSE;
+
+  pbuf = g_slice_new (GstFFMpegPacketBuffer);
+  if (!gst_buffer_map (buffer, &pbuf->map, GST_MAP_READ)) {
+    g_slice_free (GstFFMpegPacketBuffer, pbuf);
+    return FALSE;
+  }
+
+  if (pbuf->map.size == 0) {
+    gst_buffer_unmap (buffer, &pbuf->map);
+    g_slice_free (GstFFMpegPacketBuffer, pbuf);
+    return TRUE;
+  }
+
+  if (!GST_MEMORY_IS_ZERO_PADDED (pbuf->map.memory)
+      || (pbuf->map.maxsize - pbuf->map.size) < AV_INPUT_BUFFER_PADDING_SIZE) {
+    /* av_new_packet() zeroes the padding for us */
+    if (av_new_packet (packet, pbuf->map.size) < 0) {
+      gst_buffer_unmap (buffer, &pbuf->map);
+      g_slice_free (GstFFMpegPacketBuffer, pbuf);
+      return FALSE;
+    }
+    memcpy (packet->data, pbuf->map.data, pbuf->map.size);
+    gst_buffer_unmap (buffer, &pbuf->map);
+    g_slice_free (GstFFMpegPacketBuffer, pbuf);
+    *copied = TRUE;
+    return TRUE;
+  }
+
+  pbuf->buffer = gst_buffer_ref (buffer);
+  packet->buf = av_buffer_create (pbuf->map.data, pbuf->map.size,
+      gst_ffmpeg_packet_buffer_free, pbuf, AV_BUFFER_FLAG_READONLY);
+  if (packet->buf == NULL) {
+    gst_ffmpeg_packet_buffer_free (pbuf, NULL);
+    return FALSE;
+  }
+  packet->data = pbuf->map.data;
+  packet->size = pbuf->map.size;
+
+  return TRUE;
+}
+
+/*
+ * Counts @decode_time in the @histogram of GST_FFMPEG_DECODE_TIME_BUCKETS
+ * buckets, each one twice as wide as the previous one.
+ */
+void
+gst_ffmpeg_decode_time_histogram_add (guint * histogram,
+    GstClockTime decode_time)
+{
+  GstClockTime limit = GST_MSECOND;
+  guint i;
+
+  for (i = 0; i < GST_FFMPEG_DECODE_TIME_BUCKETS - 1; i++) {
+    if (decode_time < limit)
+      break;
+    limit *= 2;
+  }
+
+  g_atomic_int_inc (&histogram[i]);
+}
+
+/*
+ * Adds the @histogram as "decode-time-histogram" array of guint64 to @stats.
+ */
+void
+gst_ffmpeg_stats_set_decode_time_histogram (GstStructure * stats,
+    guint * histogram)
+{
+  GValue array = G_VALUE_INIT;
+  GValue v = G_VALUE_INIT;
+  guint i;
+
+  gst_value_array_init (&array, GST_FFMPEG_DECODE_TIME_BUCKETS);
+  g_value_init (&v, G_TYPE_UINT64);
+  for (i = 0; i < GST_FFMPEG_DECODE_TIME_BUCKETS; i++) {
+    g_value_set_uint64 (&v, g_atomic_int_get (&histogram[i]));
+    gst_value_array_append_value (&array, &v);
+  }
+  g_value_unset (&v);
+
+  gst_structure_take_value (stats, "decode-time-histogram", &array);
+}
@@ -114,4 +114,26 @@ av_smp_format_depth(enum AVSampleFormat smp_fmt);
 GstBuffer *
 new_aligned_buffer (gint size);
 
+gboolean
+gst_ffmpeg_avpacket_from_buffer (AVPacket * packet, GstBuffer * buffer,
+                                 gboolean * copied);
+
+/* decode time histogram buckets: < 1ms, < 2ms, < 4ms ... < 64ms, >= 64ms */
+#define GST_FFMPEG_DECODE_TIME_BUCKETS 8
+
+/* the decoder stats are updated from the streaming thread and libav threads,
+ * and read from the application. The counters are guints so that they can be
+ * updated atomically without taking a lock */
+#define STATS_INC(dec, counter) g_atomic_int_inc (&(dec)->stats.counter)
+#define STATS_GET(dec, counter) \
+  ((guint64) g_atomic_int_get (&(dec)->stats.counter))
+
+void
+gst_ffmpeg_decode_time_histogram_add (guint * histogram,
+                                      GstClockTime decode_time);
+
+void
+gst_ffmpeg_stats_set_decode_time_histogram (GstStructure * stats,
+                                            guint * histogram);
+
 #endif /* __GST_FFMPEG_UTILS_H__ */
@@ -25,8 +25,11 @@
 #include <string.h>
 
 #include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
 #include <libavutil/stereo3d.h>
 #include <libavutil/mastering_display_metadata.h>
+#include <libswscale/swscale.h>
 
 #include "gstav.h"
 #include "gstavcodecmap.h"
@@ -47,6 +50,54 @@ GST_DEBUG_CATEGORY_STATIC (GST_CAT_PERFORMANCE);
 #define DEFAULT_STRIDE_ALIGN            31
 #define DEFAULT_ALLOC_PARAM             { 0, DEFAULT_STRIDE_ALIGN, 0, 0, }
 #define DEFAULT_THREAD_TYPE             0
+#define DEFAULT_STRIDE_RENEGOTIATION    TRUE
+#define DEFAULT_ASYNC_OUTPUT            FALSE
+#define DEFAULT_ADAPTIVE_THREADS        FALSE
+#define DEFAULT_SHARED_THREADS          FALSE
+#define DEFAULT_MAX_LATENCY_FRAMES      0
+#define DEFAULT_CONTEXT_CACHE_TIME      0
+#define DEFAULT_STATS_INTERVAL          0
+#define DEFAULT_THUMBNAIL               FALSE
+#define DEFAULT_OUTPUT_CONVERSION       FALSE
+#define DEFAULT_PARALLEL_CONTEXTS       0
+#define DEFAULT_SCRUB_CACHE_SIZE        0
+#define ASYNC_OUTPUT_MAX_FRAMES         4
+
+/* upper bounds for the buffers the internal pool allocates when it is
+ * activated, in buffers and in bytes */
+#define INTERNAL_POOL_MAX_MIN_BUFFERS   8
+#define INTERNAL_POOL_MAX_PREALLOC      (64 * 1024 * 1024)
+
+/* reordered_opaque of the packets replayed to rebuild the references of the
+ * first frame after the scrub cache, their pictures are not output */
+#define SCRUB_REPLAY_OPAQUE             G_GINT64_CONSTANT (-2)
+
+/* adaptive-threads: frames to measure before retuning, the load per thread
+ * above which threads are added and below which one is removed, and the
+ * minimum time between two retunes, doubled up to the maximum whenever the
+ * thread count goes back up after being lowered */
+#define ADAPTIVE_THREADS_MIN_FRAMES     30
+#define ADAPTIVE_THREADS_HIGH_LOAD      0.8
+#define ADAPTIVE_THREADS_LOW_LOAD       0.4
+#define ADAPTIVE_THREADS_MIN_INTERVAL   (5 * GST_SECOND)
+#define ADAPTIVE_THREADS_MAX_INTERVAL   (80 * GST_SECOND)
+
+/* QoS controller: frames to wait after a level change before escalating
+ * again, frames we need to be early for before de-escalating and how early
+ * that is when frames have no duration */
+#define QOS_HOLD_FRAMES                 4
+#define QOS_RECOVER_FRAMES              30
+#define QOS_RECOVER_MARGIN              (10 * GST_MSECOND)
+
+enum
+{
+  QOS_LEVEL_NORMAL,
+  QOS_LEVEL_SKIP_LOOP_FILTER,
+  QOS_LEVEL_SKIP_IDCT,
+  QOS_LEVEL_SKIP_NONREF,
+  QOS_LEVEL_SKIP_NONKEY,
+  QOS_LEVEL_DROP
+};
 
 enum
 {
@@ -58,6 +109,19 @@ enum
   PROP_MAX_THREADS,
   PROP_OUTPUT_CORRUPT,
   PROP_THREAD_TYPE,
+  PROP_STRIDE_RENEGOTIATION,
+  PROP_ASYNC_OUTPUT,
+  PROP_QOS_LEVEL,
+  PROP_ADAPTIVE_THREADS,
+  PROP_SHARED_THREADS,
+  PROP_MAX_LATENCY_FRAMES,
+  PROP_CONTEXT_CACHE_TIME,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_THUMBNAIL,
+  PROP_OUTPUT_CONVERSION,
+  PROP_PARALLEL_CONTEXTS,
+  PROP_SCRUB_CACHE_SIZE,
   PROP_LAST
 };
 
@@ -86,6 +150,7 @@ static void gst_ffmpegviddec_get_property (GObject * object,
 
 static gboolean gst_ffmpegviddec_negotiate (GstFFMpegVidDec * ffmpegdec,
     AVCodecContext * context, AVFrame * picture);
+static void gst_ffmpegviddec_scrub_clear (GstFFMpegVidDec * ffmpegdec);
 
 /* some sort of bufferpool handling, but different */
 static int gst_ffmpegviddec_get_buffer2 (AVCodecContext * context,
@@ -93,6 +158,8 @@ static int gst_ffmpegviddec_get_buffer2 (AVCodecContext * context,
 static gboolean gst_ffmpegviddec_can_direct_render (GstFFMpegVidDec *
     ffmpegdec);
 
+static void gst_ffmpegviddec_output_loop (GstFFMpegVidDec * ffmpegdec);
+
 static GstFlowReturn gst_ffmpegviddec_finish (GstVideoDecoder * decoder);
 static GstFlowReturn gst_ffmpegviddec_drain (GstVideoDecoder * decoder);
 
@@ -105,6 +172,9 @@ static gboolean context_changed (GstFFMpegVidDec * ffmpegdec,
 
 static GstElementClass *parent_class = NULL;
 
+/* lowres factor picked from the size downstream asks for */
+#define LOWRES_AUTO -1
+
 #define GST_FFMPEGVIDDEC_TYPE_LOWRES (gst_ffmpegviddec_lowres_get_type())
 static GType
 gst_ffmpegviddec_lowres_get_type (void)
@@ -116,6 +186,7 @@ gst_ffmpegviddec_lowres_get_type (void)
       {0, "0", "full"},
       {1, "1", "1/2-size"},
       {2, "2", "1/4-size"},
+      {LOWRES_AUTO, "Auto", "auto"},
       {0, NULL, NULL},
     };
 
@@ -169,6 +240,30 @@ gst_ffmpegviddec_thread_type_get_type (void)
   return ffmpegdec_thread_type_type;
 }
 
+#define GST_FFMPEGVIDDEC_TYPE_QOS_LEVEL (gst_ffmpegviddec_qos_level_get_type())
+static GType
+gst_ffmpegviddec_qos_level_get_type (void)
+{
+  static GType ffmpegdec_qos_level_type = 0;
+
+  if (!ffmpegdec_qos_level_type) {
+    static const GEnumValue ffmpegdec_qos_level[] = {
+      {QOS_LEVEL_NORMAL, "Decode everything", "normal"},
+      {QOS_LEVEL_SKIP_LOOP_FILTER, "Skip loop filter", "skip-loop-filter"},
+      {QOS_LEVEL_SKIP_IDCT, "Skip IDCT of non-reference frames", "skip-idct"},
+      {QOS_LEVEL_SKIP_NONREF, "Skip non-reference frames", "skip-nonref"},
+      {QOS_LEVEL_SKIP_NONKEY, "Skip non-keyframes", "skip-nonkey"},
+      {QOS_LEVEL_DROP, "Drop non-keyframes before decoding", "drop"},
+      {0, NULL, NULL},
+    };
+
+    ffmpegdec_qos_level_type =
+        g_enum_register_static ("GstLibAVVidDecQoSLevel", ffmpegdec_qos_level);
+  }
+
+  return ffmpegdec_qos_level_type;
+}
+
 static void
 gst_ffmpegviddec_base_init (GstFFMpegVidDecClass * klass)
 {
@@ -242,7 +337,8 @@ gst_ffmpegviddec_class_init (GstFFMpegVidDecClass * klass)
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
   g_object_class_install_property (gobject_class, PROP_LOWRES,
       g_param_spec_enum ("lowres", "Low resolution",
-          "At which resolution to decode images",
+          "At which resolution to decode images, auto picks the lowest the "
+          "codec supports that still covers the size downstream asks for",
           GST_FFMPEGVIDDEC_TYPE_LOWRES, 0,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
   g_object_class_install_property (gobject_class, PROP_DIRECT_RENDERING,
@@ -257,6 +353,64 @@ gst_ffmpegviddec_class_init (GstFFMpegVidDecClass * klass)
       g_param_spec_boolean ("output-corrupt", "Output corrupt buffers",
           "Whether libav should output frames even if corrupted",
           DEFAULT_OUTPUT_CORRUPT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STRIDE_RENEGOTIATION,
+      g_param_spec_boolean ("stride-renegotiation", "Stride renegotiation",
+          "Reopen the decoder at the next keyframe to direct render into a "
+          "downstream pool whose stride differs from the current one",
+          DEFAULT_STRIDE_RENEGOTIATION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ASYNC_OUTPUT,
+      g_param_spec_boolean ("async-output", "Asynchronous output",
+          "Push decoded frames downstream from a separate thread so that "
+          "decoding the next packets overlaps with downstream processing",
+          DEFAULT_ASYNC_OUTPUT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_QOS_LEVEL,
+      g_param_spec_enum ("qos-level", "QoS level",
+          "Decoding shortcuts currently taken because of QoS",
+          GST_FFMPEGVIDDEC_TYPE_QOS_LEVEL, QOS_LEVEL_NORMAL,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CONTEXT_CACHE_TIME,
+      g_param_spec_uint ("context-cache-time", "Context cache time",
+          "Milliseconds to keep the codec open after stopping, for another "
+          "decoder with the same configuration to take over (0 = disabled)",
+          0, G_MAXUINT, DEFAULT_CONTEXT_CACHE_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Decoder performance counters since the decoder was started",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Statistics interval",
+          "Post the stats as element message every this many milliseconds "
+          "(0 = disabled)", 0, G_MAXUINT, DEFAULT_STATS_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_THUMBNAIL,
+      g_param_spec_boolean ("thumbnail", "Thumbnail mode",
+          "Only decode keyframes, without loop filter and at the lowest "
+          "resolution that still covers the size downstream asks for",
+          DEFAULT_THUMBNAIL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_OUTPUT_CONVERSION,
+      g_param_spec_boolean ("output-conversion", "Output conversion",
+          "Scale and convert the decoded pictures to the size and format "
+          "downstream asks for while copying them to the output buffers",
+          DEFAULT_OUTPUT_CONVERSION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PARALLEL_CONTEXTS,
+      g_param_spec_int ("parallel-contexts", "Parallel contexts",
+          "Decode the packets of intra-only codecs on this many codec "
+          "contexts in parallel (0, 1 = disabled)",
+          0, 64, DEFAULT_PARALLEL_CONTEXTS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_SCRUB_CACHE_SIZE,
+      g_param_spec_uint64 ("scrub-cache-size", "Scrub cache size",
+          "Bytes of recently output pictures to keep, so that after a "
+          "flushing seek back into them they are not decoded again. Only "
+          "used for streams without frame reordering, e.g. without "
+          "B-frames (0 = disabled)", 0, G_MAXUINT64, DEFAULT_SCRUB_CACHE_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   caps = klass->in_plugin->capabilities;
   if (caps & (AV_CODEC_CAP_FRAME_THREADS | AV_CODEC_CAP_SLICE_THREADS)) {
@@ -270,6 +424,32 @@ gst_ffmpegviddec_class_init (GstFFMpegVidDecClass * klass)
             "Multithreading methods to use",
             GST_FFMPEGVIDDEC_TYPE_THREAD_TYPE,
             DEFAULT_THREAD_TYPE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass),
+        PROP_ADAPTIVE_THREADS, g_param_spec_boolean ("adaptive-threads",
+            "Adaptive threads",
+            "Start with a single thread and adjust the number of threads "
+            "(up to max-threads) at keyframes to what is needed to decode in "
+            "real time. Changing it reopens the codec, so this is done at "
+            "most every few seconds", DEFAULT_ADAPTIVE_THREADS,
+            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+            GST_PARAM_MUTABLE_READY));
+    g_object_class_install_property (G_OBJECT_CLASS (klass),
+        PROP_SHARED_THREADS, g_param_spec_boolean ("shared-threads",
+            "Shared threads",
+            "Run the slice threading jobs on a worker pool shared by all "
+            "libav decoders in the process, so that instances share the CPUs",
+            DEFAULT_SHARED_THREADS,
+            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+            GST_PARAM_MUTABLE_READY));
+    g_object_class_install_property (G_OBJECT_CLASS (klass),
+        PROP_MAX_LATENCY_FRAMES, g_param_spec_int ("max-latency-frames",
+            "Maximum latency in frames",
+            "With live upstream, allow frame threading with as many threads "
+            "as keep the decoder latency within this many frames "
+            "(0 = no frame threading for live upstream)",
+            0, G_MAXINT, DEFAULT_MAX_LATENCY_FRAMES,
+            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+            GST_PARAM_MUTABLE_READY));
   }
 
   viddec_class->set_format = gst_ffmpegviddec_set_format;
@@ -287,6 +467,7 @@ gst_ffmpegviddec_class_init (GstFFMpegVidDecClass * klass)
   gst_type_mark_as_plugin_api (GST_FFMPEGVIDDEC_TYPE_LOWRES, 0);
   gst_type_mark_as_plugin_api (GST_FFMPEGVIDDEC_TYPE_SKIPFRAME, 0);
   gst_type_mark_as_plugin_api (GST_FFMPEGVIDDEC_TYPE_THREAD_TYPE, 0);
+  gst_type_mark_as_plugin_api (GST_FFMPEGVIDDEC_TYPE_QOS_LEVEL, 0);
 }
 
 static void
@@ -306,6 +487,43 @@ gst_ffmpegviddec_init (GstFFMpegVidDec * ffmpegdec)
   ffmpegdec->max_threads = DEFAULT_MAX_THREADS;
   ffmpegdec->output_corrupt = DEFAULT_OUTPUT_CORRUPT;
   ffmpegdec->thread_type = DEFAULT_THREAD_TYPE;
+  ffmpegdec->stride_renegotiation = DEFAULT_STRIDE_RENEGOTIATION;
+  ffmpegdec->adaptive_threads = DEFAULT_ADAPTIVE_THREADS;
+  ffmpegdec->shared_threads = DEFAULT_SHARED_THREADS;
+  ffmpegdec->max_latency_frames = DEFAULT_MAX_LATENCY_FRAMES;
+  ffmpegdec->context_cache_time = DEFAULT_CONTEXT_CACHE_TIME;
+  ffmpegdec->stats_interval = DEFAULT_STATS_INTERVAL;
+  ffmpegdec->thumbnail = DEFAULT_THUMBNAIL;
+  ffmpegdec->output_conversion = DEFAULT_OUTPUT_CONVERSION;
+  ffmpegdec->parallel_contexts = DEFAULT_PARALLEL_CONTEXTS;
+  ffmpegdec->scrub_cache_size = DEFAULT_SCRUB_CACHE_SIZE;
+  ffmpegdec->stats_last_post = GST_CLOCK_TIME_NONE;
+  ffmpegdec->adaptive_last_change = GST_CLOCK_TIME_NONE;
+  ffmpegdec->adaptive_interval = ADAPTIVE_THREADS_MIN_INTERVAL;
+
+  g_mutex_init (&ffmpegdec->frames_lock);
+  ffmpegdec->pending_frames = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) gst_video_codec_frame_unref);
+  g_queue_init (&ffmpegdec->ghost_candidates);
+
+  ffmpegdec->async_output = DEFAULT_ASYNC_OUTPUT;
+  g_mutex_init (&ffmpegdec->output_lock);
+  g_cond_init (&ffmpegdec->output_cond);
+  g_queue_init (&ffmpegdec->output_queue);
+  g_rec_mutex_init (&ffmpegdec->output_task_lock);
+  ffmpegdec->output_task =
+      gst_task_new ((GstTaskFunction) gst_ffmpegviddec_output_loop, ffmpegdec,
+      NULL);
+  gst_task_set_lock (ffmpegdec->output_task, &ffmpegdec->output_task_lock);
+  ffmpegdec->output_flow = GST_FLOW_OK;
+
+  g_mutex_init (&ffmpegdec->parallel_lock);
+  g_cond_init (&ffmpegdec->parallel_cond);
+  g_queue_init (&ffmpegdec->parallel_jobs);
+
+  ffmpegdec->scrub_cache = g_hash_table_new (g_int64_hash, g_int64_equal);
+  g_queue_init (&ffmpegdec->scrub_lru);
+  g_queue_init (&ffmpegdec->scrub_replay);
 
   GST_PAD_SET_ACCEPT_TEMPLATE (GST_VIDEO_DECODER_SINK_PAD (ffmpegdec));
   gst_video_decoder_set_use_default_pad_acceptcaps (GST_VIDEO_DECODER_CAST
@@ -326,10 +544,237 @@ gst_ffmpegviddec_finalize (GObject * object)
     av_free (ffmpegdec->context);
     ffmpegdec->context = NULL;
   }
+  g_free (ffmpegdec->context_key);
+
+  g_queue_clear_full (&ffmpegdec->ghost_candidates,
+      (GDestroyNotify) gst_video_codec_frame_unref);
+  g_hash_table_unref (ffmpegdec->pending_frames);
+  g_mutex_clear (&ffmpegdec->frames_lock);
+
+  gst_object_unref (ffmpegdec->output_task);
+  g_rec_mutex_clear (&ffmpegdec->output_task_lock);
+  g_queue_clear (&ffmpegdec->output_queue);
+  g_cond_clear (&ffmpegdec->output_cond);
+  g_mutex_clear (&ffmpegdec->output_lock);
+
+  g_cond_clear (&ffmpegdec->parallel_cond);
+  g_mutex_clear (&ffmpegdec->parallel_lock);
+
+  gst_ffmpegviddec_scrub_clear (ffmpegdec);
+  g_hash_table_unref (ffmpegdec->scrub_cache);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
+static void
+gst_ffmpegviddec_add_pending_frame (GstFFMpegVidDec * ffmpegdec,
+    GstVideoCodecFrame * frame)
+{
+  g_mutex_lock (&ffmpegdec->frames_lock);
+  g_hash_table_insert (ffmpegdec->pending_frames,
+      GINT_TO_POINTER (frame->system_frame_number),
+      gst_video_codec_frame_ref (frame));
+  g_mutex_unlock (&ffmpegdec->frames_lock);
+
+  g_queue_push_tail (&ffmpegdec->ghost_candidates,
+      gst_video_codec_frame_ref (frame));
+}
+
+/* Returns: (transfer full) the pending frame with @system_frame_number */
+static GstVideoCodecFrame *
+gst_ffmpegviddec_get_pending_frame (GstFFMpegVidDec * ffmpegdec,
+    gint system_frame_number)
+{
+  GstVideoCodecFrame *frame;
+
+  g_mutex_lock (&ffmpegdec->frames_lock);
+  frame = g_hash_table_lookup (ffmpegdec->pending_frames,
+      GINT_TO_POINTER (system_frame_number));
+  if (frame)
+    gst_video_codec_frame_ref (frame);
+  g_mutex_unlock (&ffmpegdec->frames_lock);
+
+  return frame;
+}
+
+static void
+gst_ffmpegviddec_remove_pending_frame (GstFFMpegVidDec * ffmpegdec,
+    GstVideoCodecFrame * frame)
+{
+  g_mutex_lock (&ffmpegdec->frames_lock);
+  g_hash_table_remove (ffmpegdec->pending_frames,
+      GINT_TO_POINTER (frame->system_frame_number));
+  g_mutex_unlock (&ffmpegdec->frames_lock);
+}
+
+static void
+gst_ffmpegviddec_clear_pending_frames (GstFFMpegVidDec * ffmpegdec)
+{
+  GstVideoCodecFrame *frame;
+
+  g_mutex_lock (&ffmpegdec->frames_lock);
+  g_hash_table_remove_all (ffmpegdec->pending_frames);
+  g_mutex_unlock (&ffmpegdec->frames_lock);
+
+  while ((frame = g_queue_pop_head (&ffmpegdec->ghost_candidates)))
+    gst_video_codec_frame_unref (frame);
+}
+
+/* Runs on output_task, pushes the queued buffers downstream in order */
+static void
+gst_ffmpegviddec_output_loop (GstFFMpegVidDec * ffmpegdec)
+{
+  GstBuffer *buffer;
+  GstFlowReturn ret;
+
+  g_mutex_lock (&ffmpegdec->output_lock);
+  while (g_queue_is_empty (&ffmpegdec->output_queue)
+      && !ffmpegdec->output_flushing)
+    g_cond_wait (&ffmpegdec->output_cond, &ffmpegdec->output_lock);
+
+  if (ffmpegdec->output_flushing) {
+    g_mutex_unlock (&ffmpegdec->output_lock);
+    gst_task_pause (ffmpegdec->output_task);
+    return;
+  }
+
+  buffer = g_queue_pop_head (&ffmpegdec->output_queue);
+  ffmpegdec->output_busy = TRUE;
+  ffmpegdec->output_thread = g_thread_self ();
+  g_cond_broadcast (&ffmpegdec->output_cond);
+  g_mutex_unlock (&ffmpegdec->output_lock);
+
+  ret = gst_pad_push (GST_VIDEO_DECODER_SRC_PAD (ffmpegdec), buffer);
+
+  g_mutex_lock (&ffmpegdec->output_lock);
+  ffmpegdec->output_busy = FALSE;
+  ffmpegdec->output_thread = NULL;
+  if (ret != GST_FLOW_OK && ffmpegdec->output_flow == GST_FLOW_OK) {
+    GST_DEBUG_OBJECT (ffmpegdec, "output task got flow %s",
+        gst_flow_get_name (ret));
+    ffmpegdec->output_flow = ret;
+  }
+  g_cond_broadcast (&ffmpegdec->output_cond);
+  g_mutex_unlock (&ffmpegdec->output_lock);
+}
+
+/* async-output: the base class prepares the output buffers with the stream
+ * lock held as usual, buffers it pushes are handed to output_task from here
+ * instead, blocking while the queue is full. Serialized events and queries
+ * wait for the queued buffers to go out first to keep their order. */
+static GstPadProbeReturn
+gst_ffmpegviddec_output_probe (GstPad * pad, GstPadProbeInfo * info,
+    GstFFMpegVidDec * ffmpegdec)
+{
+  GstPadProbeReturn res = GST_PAD_PROBE_OK;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+    if (!GST_EVENT_IS_SERIALIZED (event)
+        || GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP)
+      return GST_PAD_PROBE_OK;
+  } else if (GST_PAD_PROBE_INFO_TYPE (info) &
+      GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM) {
+    if (!GST_QUERY_IS_SERIALIZED (GST_PAD_PROBE_INFO_QUERY (info)))
+      return GST_PAD_PROBE_OK;
+  }
+
+  g_mutex_lock (&ffmpegdec->output_lock);
+  /* output_task pushing what it dequeued */
+  if (ffmpegdec->output_thread == g_thread_self ()) {
+    g_mutex_unlock (&ffmpegdec->output_lock);
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+    if (gst_task_get_state (ffmpegdec->output_task) != GST_TASK_STARTED) {
+      ffmpegdec->output_flushing = FALSE;
+      ffmpegdec->output_flow = GST_FLOW_OK;
+      gst_task_start (ffmpegdec->output_task);
+    }
+
+    while (g_queue_get_length (&ffmpegdec->output_queue) >=
+        ASYNC_OUTPUT_MAX_FRAMES && ffmpegdec->output_flow == GST_FLOW_OK
+        && !ffmpegdec->output_flushing)
+      g_cond_wait (&ffmpegdec->output_cond, &ffmpegdec->output_lock);
+
+    /* the error is returned by gst_ffmpegviddec_finish_frame() */
+    if (ffmpegdec->output_flow == GST_FLOW_OK && !ffmpegdec->output_flushing) {
+      g_queue_push_tail (&ffmpegdec->output_queue, buffer);
+      g_cond_broadcast (&ffmpegdec->output_cond);
+    } else {
+      gst_buffer_unref (buffer);
+    }
+    GST_PAD_PROBE_INFO_DATA (info) = NULL;
+    res = GST_PAD_PROBE_HANDLED;
+  } else {
+    while ((!g_queue_is_empty (&ffmpegdec->output_queue)
+            || ffmpegdec->output_busy) && !ffmpegdec->output_flushing)
+      g_cond_wait (&ffmpegdec->output_cond, &ffmpegdec->output_lock);
+  }
+  g_mutex_unlock (&ffmpegdec->output_lock);
+
+  return res;
+}
+
+/* with STREAM_LOCK. Finishes @frame, with async-output its buffer is only
+ * queued for output_task then. Returns the last flow the output task got
+ * in that case */
+static GstFlowReturn
+gst_ffmpegviddec_finish_frame (GstFFMpegVidDec * ffmpegdec,
+    GstVideoCodecFrame * frame)
+{
+  GstFlowReturn ret;
+
+  ret = gst_video_decoder_finish_frame (GST_VIDEO_DECODER (ffmpegdec), frame);
+
+  if (ret == GST_FLOW_OK && ffmpegdec->output_probe) {
+    g_mutex_lock (&ffmpegdec->output_lock);
+    ret = ffmpegdec->output_flow;
+    g_mutex_unlock (&ffmpegdec->output_lock);
+  }
+
+  return ret;
+}
+
+/* Waits until every queued buffer was pushed */
+static GstFlowReturn
+gst_ffmpegviddec_wait_output (GstFFMpegVidDec * ffmpegdec)
+{
+  GstFlowReturn ret;
+
+  g_mutex_lock (&ffmpegdec->output_lock);
+  while ((!g_queue_is_empty (&ffmpegdec->output_queue)
+          || ffmpegdec->output_busy) && !ffmpegdec->output_flushing)
+    g_cond_wait (&ffmpegdec->output_cond, &ffmpegdec->output_lock);
+  ret = ffmpegdec->output_flow;
+  g_mutex_unlock (&ffmpegdec->output_lock);
+
+  return ret;
+}
+
+/* Stops the output task and drops the buffers it didn't push yet */
+static void
+gst_ffmpegviddec_stop_output (GstFFMpegVidDec * ffmpegdec)
+{
+  g_mutex_lock (&ffmpegdec->output_lock);
+  ffmpegdec->output_flushing = TRUE;
+  g_cond_broadcast (&ffmpegdec->output_cond);
+  g_mutex_unlock (&ffmpegdec->output_lock);
+
+  gst_task_stop (ffmpegdec->output_task);
+  gst_task_join (ffmpegdec->output_task);
+
+  g_mutex_lock (&ffmpegdec->output_lock);
+  g_queue_clear_full (&ffmpegdec->output_queue,
+      (GDestroyNotify) gst_buffer_unref);
+  ffmpegdec->output_flow = GST_FLOW_OK;
+  g_mutex_unlock (&ffmpegdec->output_lock);
+}
+
 static void
 gst_ffmpegviddec_context_set_flags (AVCodecContext * context, guint flags,
     gboolean enable)
@@ -343,6 +788,334 @@ gst_ffmpegviddec_context_set_flags (AVCodecContext * context, guint flags,
 }
 
 /* with LOCK */
+/* A packet decoded on one of the parallel contexts */
+typedef struct
+{
+  GstVideoCodecFrame *frame;
+  AVPacket *packet;
+  AVFrame *picture;
+  /* the QoS and trick mode settings of the main context at submission */
+  enum AVDiscard skip_frame;
+  enum AVDiscard skip_loop_filter;
+  enum AVDiscard skip_idct;
+  gint res;
+  gboolean done;
+} GstFFMpegVidDecParallelJob;
+
+static void
+gst_ffmpegviddec_parallel_job_free (GstFFMpegVidDecParallelJob * job)
+{
+  /* releases the picture and with it the frame it was decoded for */
+  av_frame_free (&job->picture);
+  av_packet_free (&job->packet);
+  gst_video_codec_frame_unref (job->frame);
+  g_slice_free (GstFFMpegVidDecParallelJob, job);
+}
+
+/* Runs on parallel_pool, decodes the packet of @job on an idle context */
+static void
+gst_ffmpegviddec_parallel_decode (GstFFMpegVidDecParallelJob * job,
+    GstFFMpegVidDec * ffmpegdec)
+{
+  AVCodecContext *context = g_async_queue_pop (ffmpegdec->parallel_idle);
+
+  context->reordered_opaque = (gint64) job->frame->system_frame_number;
+  context->skip_frame = job->skip_frame;
+  context->skip_loop_filter = job->skip_loop_filter;
+  context->skip_idct = job->skip_idct;
+  job->res = avcodec_send_packet (context, job->packet);
+  if (job->res >= 0)
+    job->res = avcodec_receive_frame (context, job->picture);
+
+  g_async_queue_push (ffmpegdec->parallel_idle, context);
+
+  g_mutex_lock (&ffmpegdec->parallel_lock);
+  job->done = TRUE;
+  g_cond_broadcast (&ffmpegdec->parallel_cond);
+  g_mutex_unlock (&ffmpegdec->parallel_lock);
+}
+
+/* Waits for the packets being decoded in parallel and drops the pictures */
+static void
+gst_ffmpegviddec_parallel_discard (GstFFMpegVidDec * ffmpegdec)
+{
+  GstFFMpegVidDecParallelJob *job;
+
+  g_mutex_lock (&ffmpegdec->parallel_lock);
+  while ((job = g_queue_pop_head (&ffmpegdec->parallel_jobs))) {
+    while (!job->done)
+      g_cond_wait (&ffmpegdec->parallel_cond, &ffmpegdec->parallel_lock);
+    g_mutex_unlock (&ffmpegdec->parallel_lock);
+    gst_ffmpegviddec_parallel_job_free (job);
+    g_mutex_lock (&ffmpegdec->parallel_lock);
+  }
+  g_mutex_unlock (&ffmpegdec->parallel_lock);
+}
+
+/* Every packet of an intra-only codec can be decoded on its own, by any
+ * context */
+static gboolean
+gst_ffmpegviddec_can_decode_parallel (GstFFMpegVidDec * ffmpegdec)
+{
+  GstFFMpegVidDecClass *oclass;
+  const AVCodecDescriptor *desc;
+
+  oclass = (GstFFMpegVidDecClass *) (G_OBJECT_GET_CLASS (ffmpegdec));
+
+  if (ffmpegdec->parallel_contexts < 2)
+    return FALSE;
+
+  desc = avcodec_descriptor_get (oclass->in_plugin->id);
+
+  return desc != NULL && (desc->props & AV_CODEC_PROP_INTRA_ONLY);
+}
+
+static void
+gst_ffmpegviddec_parallel_stop (GstFFMpegVidDec * ffmpegdec)
+{
+  AVCodecContext *context;
+
+  if (ffmpegdec->parallel_pool == NULL)
+    return;
+
+  gst_ffmpegviddec_parallel_discard (ffmpegdec);
+  g_thread_pool_free (ffmpegdec->parallel_pool, FALSE, TRUE);
+  ffmpegdec->parallel_pool = NULL;
+
+  while ((context = g_async_queue_try_pop (ffmpegdec->parallel_idle))) {
+    gst_ffmpeg_avcodec_close (context);
+    avcodec_free_context (&context);
+  }
+  g_async_queue_unref (ffmpegdec->parallel_idle);
+  ffmpegdec->parallel_idle = NULL;
+}
+
+/* Opens parallel_contexts contexts configured like the opened main one,
+ * and the threads to decode on them. The main context stays open with a
+ * single thread: it still drives the output format negotiation and keeps
+ * the QoS settings that every job picks up. with LOCK */
+static void
+gst_ffmpegviddec_parallel_start (GstFFMpegVidDec * ffmpegdec)
+{
+  GstFFMpegVidDecClass *oclass;
+  AVCodecParameters *par;
+  gint i, n = 0;
+
+  if (!gst_ffmpegviddec_can_decode_parallel (ffmpegdec))
+    return;
+
+  oclass = (GstFFMpegVidDecClass *) (G_OBJECT_GET_CLASS (ffmpegdec));
+
+  par = avcodec_parameters_alloc ();
+  if (par == NULL || avcodec_parameters_from_context (par,
+          ffmpegdec->context) < 0) {
+    avcodec_parameters_free (&par);
+    return;
+  }
+
+  ffmpegdec->parallel_idle = g_async_queue_new ();
+  for (i = 0; i < ffmpegdec->parallel_contexts; i++) {
+    AVCodecContext *context = avcodec_alloc_context3 (oclass->in_plugin);
+
+    if (context == NULL)
+      break;
+
+    if (avcodec_parameters_to_context (context, par) < 0) {
+      avcodec_free_context (&context);
+      break;
+    }
+    context->opaque = ffmpegdec;
+    context->get_buffer2 = gst_ffmpegviddec_get_buffer2;
+    context->thread_count = 1;
+    context->time_base = ffmpegdec->context->time_base;
+    context->lowres = ffmpegdec->context->lowres;
+    context->workaround_bugs = ffmpegdec->context->workaround_bugs;
+    context->err_recognition = ffmpegdec->context->err_recognition;
+    context->flags = ffmpegdec->context->flags;
+
+    if (gst_ffmpeg_avcodec_open (context, oclass->in_plugin) < 0) {
+      avcodec_free_context (&context);
+      break;
+    }
+
+    g_async_queue_push (ffmpegdec->parallel_idle, context);
+    n++;
+  }
+  avcodec_parameters_free (&par);
+
+  ffmpegdec->parallel_pool =
+      g_thread_pool_new ((GFunc) gst_ffmpegviddec_parallel_decode, ffmpegdec,
+      MAX (n, 1), TRUE, NULL);
+  ffmpegdec->parallel_n = n;
+
+  if (n < 2) {
+    GST_WARNING_OBJECT (ffmpegdec, "could only open %d parallel contexts", n);
+    gst_ffmpegviddec_parallel_stop (ffmpegdec);
+    return;
+  }
+
+  GST_DEBUG_OBJECT (ffmpegdec, "decoding on %d contexts in parallel", n);
+}
+
+/* A picture in the scrub cache, keyed by the input PTS */
+typedef struct
+{
+  GstClockTime pts;
+  GstClockTime dts;
+  GstBuffer *buffer;
+  gsize size;
+  /* in scrub_lru, least recently used first */
+  GList link;
+} GstFFMpegVidDecScrubEntry;
+
+static void
+gst_ffmpegviddec_scrub_entry_free (GstFFMpegVidDecScrubEntry * entry)
+{
+  gst_buffer_unref (entry->buffer);
+  g_slice_free (GstFFMpegVidDecScrubEntry, entry);
+}
+
+static void
+gst_ffmpegviddec_scrub_remove (GstFFMpegVidDec * ffmpegdec,
+    GstFFMpegVidDecScrubEntry * entry)
+{
+  g_hash_table_remove (ffmpegdec->scrub_cache, &entry->pts);
+  g_queue_unlink (&ffmpegdec->scrub_lru, &entry->link);
+  ffmpegdec->scrub_cache_bytes -= entry->size;
+  gst_ffmpegviddec_scrub_entry_free (entry);
+}
+
+static void
+gst_ffmpegviddec_scrub_clear (GstFFMpegVidDec * ffmpegdec)
+{
+  GList *l;
+
+  while ((l = g_queue_peek_head_link (&ffmpegdec->scrub_lru)))
+    gst_ffmpegviddec_scrub_remove (ffmpegdec, l->data);
+
+  g_queue_clear_full (&ffmpegdec->scrub_replay,
+      (GDestroyNotify) gst_buffer_unref);
+  g_free (ffmpegdec->scrub_stream_id);
+  ffmpegdec->scrub_stream_id = NULL;
+  ffmpegdec->scrub_serving = FALSE;
+  gst_object_replace ((GstObject **) & ffmpegdec->scrub_pool, NULL);
+}
+
+/* Pictures are cached by reference, which keeps their buffers from going
+ * back to their pool. Leave out the buffers of pools with a buffer limit,
+ * holding on to them could starve the pool */
+static gboolean
+gst_ffmpegviddec_scrub_can_keep (GstFFMpegVidDec * ffmpegdec,
+    GstBuffer * buffer)
+{
+  if (buffer->pool == NULL)
+    return TRUE;
+
+  if (buffer->pool != ffmpegdec->scrub_pool) {
+    GstStructure *config;
+    guint max_buffers = 0;
+
+    config = gst_buffer_pool_get_config (buffer->pool);
+    gst_buffer_pool_config_get_params (config, NULL, NULL, NULL,
+        &max_buffers);
+    gst_structure_free (config);
+
+    gst_object_replace ((GstObject **) & ffmpegdec->scrub_pool,
+        (GstObject *) buffer->pool);
+    ffmpegdec->scrub_pool_limited = max_buffers != 0;
+  }
+
+  return !ffmpegdec->scrub_pool_limited;
+}
+
+/* Keeps a reference to the output buffer of @frame. Downstream can't write
+ * into a buffer that is shared with the cache, it has to copy it first */
+static void
+gst_ffmpegviddec_scrub_insert (GstFFMpegVidDec * ffmpegdec,
+    GstVideoCodecFrame * frame)
+{
+  GstFFMpegVidDecScrubEntry *entry;
+  gsize size;
+
+  if (ffmpegdec->scrub_cache_size == 0
+      || !GST_CLOCK_TIME_IS_VALID (frame->pts))
+    return;
+
+  size = gst_buffer_get_size (frame->output_buffer);
+  if (size > ffmpegdec->scrub_cache_size
+      || !gst_ffmpegviddec_scrub_can_keep (ffmpegdec, frame->output_buffer))
+    return;
+
+  entry = g_hash_table_lookup (ffmpegdec->scrub_cache, &frame->pts);
+  if (entry)
+    gst_ffmpegviddec_scrub_remove (ffmpegdec, entry);
+
+  while (ffmpegdec->scrub_cache_bytes + size > ffmpegdec->scrub_cache_size)
+    gst_ffmpegviddec_scrub_remove (ffmpegdec,
+        g_queue_peek_head (&ffmpegdec->scrub_lru));
+
+  if (ffmpegdec->scrub_stream_id == NULL)
+    ffmpegdec->scrub_stream_id =
+        gst_pad_get_stream_id (GST_VIDEO_DECODER_SINK_PAD (ffmpegdec));
+
+  entry = g_slice_new0 (GstFFMpegVidDecScrubEntry);
+  entry->pts = frame->pts;
+  entry->dts = frame->dts;
+  entry->buffer = gst_buffer_ref (frame->output_buffer);
+  entry->size = size;
+  entry->link.data = entry;
+
+  g_hash_table_insert (ffmpegdec->scrub_cache, &entry->pts, entry);
+  g_queue_push_tail_link (&ffmpegdec->scrub_lru, &entry->link);
+  ffmpegdec->scrub_cache_bytes += size;
+}
+
+static GstBuffer *
+gst_ffmpegviddec_scrub_lookup (GstFFMpegVidDec * ffmpegdec,
+    GstVideoCodecFrame * frame)
+{
+  GstFFMpegVidDecScrubEntry *entry;
+
+  if (!GST_CLOCK_TIME_IS_VALID (frame->pts))
+    return NULL;
+
+  entry = g_hash_table_lookup (ffmpegdec->scrub_cache, &frame->pts);
+  if (entry == NULL || entry->dts != frame->dts)
+    return NULL;
+
+  g_queue_unlink (&ffmpegdec->scrub_lru, &entry->link);
+  g_queue_push_tail_link (&ffmpegdec->scrub_lru, &entry->link);
+
+  return gst_buffer_ref (entry->buffer);
+}
+
+/* After a flush the pictures can be served from the cache again, as long as
+ * they belong to the stream they were cached from */
+static void
+gst_ffmpegviddec_scrub_start (GstFFMpegVidDec * ffmpegdec)
+{
+  gchar *stream_id;
+
+  g_queue_clear_full (&ffmpegdec->scrub_replay,
+      (GDestroyNotify) gst_buffer_unref);
+
+  if (g_queue_is_empty (&ffmpegdec->scrub_lru))
+    return;
+
+  stream_id = gst_pad_get_stream_id (GST_VIDEO_DECODER_SINK_PAD (ffmpegdec));
+  if (g_strcmp0 (stream_id, ffmpegdec->scrub_stream_id) != 0) {
+    GST_DEBUG_OBJECT (ffmpegdec, "new stream, clearing scrub cache");
+    gst_ffmpegviddec_scrub_clear (ffmpegdec);
+  } else if (ffmpegdec->context->has_b_frames > 0) {
+    /* hits are finished in decoding order, which is not the presentation
+     * order when libav reorders */
+    GST_DEBUG_OBJECT (ffmpegdec, "stream reorders, not serving scrub cache");
+  } else {
+    ffmpegdec->scrub_serving = TRUE;
+  }
+  g_free (stream_id);
+}
+
 static gboolean
 gst_ffmpegviddec_close (GstFFMpegVidDec * ffmpegdec, gboolean reset)
 {
@@ -355,6 +1128,8 @@ gst_ffmpegviddec_close (GstFFMpegVidDec * ffmpegdec, gboolean reset)
 
   gst_caps_replace (&ffmpegdec->last_caps, NULL);
 
+  gst_ffmpegviddec_parallel_stop (ffmpegdec);
+
   gst_ffmpeg_avcodec_close (ffmpegdec->context);
   ffmpegdec->opened = FALSE;
 
@@ -378,59 +1153,396 @@ gst_ffmpegviddec_close (GstFFMpegVidDec * ffmpegdec, gboolean reset)
   return TRUE;
 }
 
-/* with LOCK */
-static gboolean
-gst_ffmpegviddec_open (GstFFMpegVidDec * ffmpegdec)
+/* with LOCK */
+static gboolean
+gst_ffmpegviddec_open (GstFFMpegVidDec * ffmpegdec)
+{
+  GstFFMpegVidDecClass *oclass;
+  gboolean shared = FALSE;
+  guint i;
+
+  oclass = (GstFFMpegVidDecClass *) (G_OBJECT_GET_CLASS (ffmpegdec));
+
+  if (ffmpegdec->shared_threads) {
+    if (gst_ffmpeg_avcodec_open_shared (ffmpegdec->context, oclass->in_plugin,
+            &shared) < 0)
+      goto could_not_open;
+  } else if (gst_ffmpeg_avcodec_open (ffmpegdec->context,
+          oclass->in_plugin) < 0)
+    goto could_not_open;
+
+  for (i = 0; i < G_N_ELEMENTS (ffmpegdec->stride); i++)
+    ffmpegdec->stride[i] = -1;
+
+  ffmpegdec->opened = TRUE;
+
+  GST_LOG_OBJECT (ffmpegdec, "Opened libav codec %s, id %d",
+      oclass->in_plugin->name, oclass->in_plugin->id);
+
+  if (shared)
+    GST_DEBUG_OBJECT (ffmpegdec, "slice threading on the shared pool");
+
+  gst_ffmpegviddec_context_set_flags (ffmpegdec->context,
+      AV_CODEC_FLAG_OUTPUT_CORRUPT, ffmpegdec->output_corrupt);
+
+  return TRUE;
+
+  /* ERRORS */
+could_not_open:
+  {
+    gst_ffmpegviddec_close (ffmpegdec, TRUE);
+    GST_DEBUG_OBJECT (ffmpegdec, "avdec_%s: Failed to open libav codec",
+        oclass->in_plugin->name);
+    return FALSE;
+  }
+}
+
+static void
+gst_ffmpegviddec_get_palette (GstFFMpegVidDec * ffmpegdec,
+    GstVideoCodecState * state)
+{
+  GstStructure *str = gst_caps_get_structure (state->caps, 0);
+  const GValue *palette_v;
+  GstBuffer *palette;
+
+  /* do we have a palette? */
+  if ((palette_v = gst_structure_get_value (str, "palette_data"))) {
+    palette = gst_value_get_buffer (palette_v);
+    GST_DEBUG ("got palette data %p", palette);
+    if (gst_buffer_get_size (palette) >= AVPALETTE_SIZE) {
+      gst_buffer_replace (&ffmpegdec->palette, palette);
+    }
+  }
+}
+
+/* Forget about the last output picture so that the output caps are
+ * negotiated again for the next one */
+static void
+gst_ffmpegviddec_reset_picture_state (GstFFMpegVidDec * ffmpegdec)
+{
+  ffmpegdec->pic_pix_fmt = 0;
+  ffmpegdec->pic_width = 0;
+  ffmpegdec->pic_height = 0;
+  ffmpegdec->pic_par_n = 0;
+  ffmpegdec->pic_par_d = 0;
+  ffmpegdec->pic_interlaced = 0;
+  ffmpegdec->pic_field_order = 0;
+  ffmpegdec->pic_field_order_changed = FALSE;
+  ffmpegdec->ctx_ticks = 0;
+  ffmpegdec->ctx_time_n = 0;
+  ffmpegdec->ctx_time_d = 0;
+  ffmpegdec->cur_multiview_mode = GST_VIDEO_MULTIVIEW_MODE_NONE;
+  ffmpegdec->cur_multiview_flags = GST_VIDEO_MULTIVIEW_FLAGS_NONE;
+}
+
+/* Codecs that take the picture size from the bitstream rather than from the
+ * context they were opened with */
+static gboolean
+gst_ffmpegviddec_size_in_bitstream (enum AVCodecID codec_id)
+{
+  switch (codec_id) {
+    case AV_CODEC_ID_MPEG1VIDEO:
+    case AV_CODEC_ID_MPEG2VIDEO:
+    case AV_CODEC_ID_MPEG4:
+    case AV_CODEC_ID_H264:
+    case AV_CODEC_ID_HEVC:
+    case AV_CODEC_ID_VP8:
+    case AV_CODEC_ID_VP9:
+    case AV_CODEC_ID_AV1:
+    case AV_CODEC_ID_MJPEG:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+/* Returns the part of @caps that an opened codec depends on: everything
+ * except the properties of the stream the codec doesn't use when opening,
+ * or picks up from the bitstream by itself */
+static GstStructure *
+gst_ffmpegviddec_codec_config (GstFFMpegVidDec * ffmpegdec, GstCaps * caps)
+{
+  GstFFMpegVidDecClass *oclass;
+  GstStructure *s;
+
+  oclass = (GstFFMpegVidDecClass *) (G_OBJECT_GET_CLASS (ffmpegdec));
+
+  s = gst_structure_copy (gst_caps_get_structure (caps, 0));
+  gst_structure_remove_fields (s, "framerate", "pixel-aspect-ratio",
+      "colorimetry", "chroma-site", "interlace-mode", "field-order",
+      "multiview-mode", "multiview-flags", "profile", "level", "tier", NULL);
+  if (gst_ffmpegviddec_size_in_bitstream (oclass->in_plugin->id))
+    gst_structure_remove_fields (s, "width", "height", NULL);
+
+  return s;
+}
+
+/* Check if the opened codec can keep decoding after switching to @caps.
+ * Then flushing the codec is enough and the costly close and open is
+ * avoided. */
+static gboolean
+gst_ffmpegviddec_can_reuse_context (GstFFMpegVidDec * ffmpegdec,
+    GstCaps * caps)
+{
+  GstFFMpegVidDecClass *oclass;
+  GstStructure *old_s, *new_s;
+  gboolean ret;
+
+  oclass = (GstFFMpegVidDecClass *) (G_OBJECT_GET_CLASS (ffmpegdec));
+
+  if (ffmpegdec->force_reopen || ffmpegdec->input_state == NULL)
+    return FALSE;
+
+  /* the codec id depends on the caps */
+  if (oclass->in_plugin->id == AV_CODEC_ID_WMV3 ||
+      oclass->in_plugin->id == AV_CODEC_ID_VC1)
+    return FALSE;
+
+  /* only applied when opening, and when picked from the downstream size it
+   * depends on the new size */
+  if (ffmpegdec->thumbnail || ffmpegdec->lowres == LOWRES_AUTO
+      || ffmpegdec->context->lowres != ffmpegdec->lowres)
+    return FALSE;
+
+  /* everything else, including the codec_data, has to be the same */
+  old_s = gst_ffmpegviddec_codec_config (ffmpegdec,
+      ffmpegdec->input_state->caps);
+  new_s = gst_ffmpegviddec_codec_config (ffmpegdec, caps);
+  ret = gst_structure_is_equal (old_s, new_s);
+
+  gst_structure_free (old_s);
+  gst_structure_free (new_s);
+
+  return ret;
+}
+
+/* with LOCK. Sets the framerate and pixel-aspect-ratio of @caps on the
+ * reused context, like gst_ffmpeg_caps_with_codecid() does on a fresh one.
+ * Codecs like h264 switch to two ticks per frame when opening, which the
+ * time base has to keep accounting for */
+static void
+gst_ffmpegviddec_update_reused_context (GstFFMpegVidDec * ffmpegdec,
+    GstCaps * caps)
+{
+  AVCodecContext *context = ffmpegdec->context;
+  GstStructure *s = gst_caps_get_structure (caps, 0);
+  gint num, den;
+
+  if (gst_structure_get_fraction (s, "framerate", &num, &den) && num > 0
+      && den > 0) {
+    context->time_base.num = den;
+    context->time_base.den = num * MAX (context->ticks_per_frame, 1);
+  } else {
+    GST_DEBUG_OBJECT (ffmpegdec, "forcing 25/1 framerate");
+    context->time_base.num = 1;
+    context->time_base.den = 25 * MAX (context->ticks_per_frame, 1);
+  }
+
+  if (gst_structure_get_fraction (s, "pixel-aspect-ratio", &num, &den)
+      && num > 0 && den > 0) {
+    context->sample_aspect_ratio.num = num;
+    context->sample_aspect_ratio.den = den;
+  } else {
+    context->sample_aspect_ratio.num = 0;
+    context->sample_aspect_ratio.den = 1;
+  }
+}
+
+/* with LOCK */
+static gchar *
+gst_ffmpegviddec_context_key (GstFFMpegVidDec * ffmpegdec, GstCaps * caps)
+{
+  GstFFMpegVidDecClass *oclass;
+  GstStructure *config;
+  gchar *config_str, *key;
+
+  oclass = (GstFFMpegVidDecClass *) (G_OBJECT_GET_CLASS (ffmpegdec));
+
+  config = gst_ffmpegviddec_codec_config (ffmpegdec, caps);
+  config_str = gst_structure_to_string (config);
+  key = g_strdup_printf ("%s:%d:%d:%d:%d:%s", oclass->in_plugin->name,
+      ffmpegdec->context->thread_type, ffmpegdec->context->thread_count,
+      ffmpegdec->context->lowres, ffmpegdec->shared_threads, config_str);
+  g_free (config_str);
+  gst_structure_free (config);
+
+  return key;
+}
+
+/* Take over an opened context that another instance left in the cache
+ * instead of opening the one configured for @state. with LOCK */
+static gboolean
+gst_ffmpegviddec_adopt_cached_context (GstFFMpegVidDec * ffmpegdec,
+    GstVideoCodecState * state)
+{
+  GstFFMpegVidDecClass *oclass;
+  AVCodecContext *context;
+  guint i;
+
+  oclass = (GstFFMpegVidDecClass *) (G_OBJECT_GET_CLASS (ffmpegdec));
+
+  g_free (ffmpegdec->context_key);
+  ffmpegdec->context_key = NULL;
+
+  /* the codec id depends on the caps */
+  if (ffmpegdec->context_cache_time == 0 ||
+      oclass->in_plugin->id == AV_CODEC_ID_WMV3 ||
+      oclass->in_plugin->id == AV_CODEC_ID_VC1)
+    return FALSE;
+
+  ffmpegdec->context_key =
+      gst_ffmpegviddec_context_key (ffmpegdec, state->caps);
+  context = gst_ffmpeg_avcodec_cache_pop (ffmpegdec->context_key);
+  if (context == NULL)
+    return FALSE;
+
+  /* take the per-instance settings set_format() prepared on the context it
+   * would have opened */
+  context->opaque = ffmpegdec;
+  context->get_buffer2 = gst_ffmpegviddec_get_buffer2;
+  context->draw_horiz_band = ffmpegdec->context->draw_horiz_band;
+  context->skip_frame = ffmpegdec->context->skip_frame;
+  context->skip_loop_filter = ffmpegdec->context->skip_loop_filter;
+  context->skip_idct = ffmpegdec->context->skip_idct;
+  context->debug_mv = ffmpegdec->context->debug_mv;
+  avcodec_free_context (&ffmpegdec->context);
+  ffmpegdec->context = context;
+
+  for (i = 0; i < G_N_ELEMENTS (ffmpegdec->stride); i++)
+    ffmpegdec->stride[i] = -1;
+
+  ffmpegdec->opened = TRUE;
+
+  gst_ffmpegviddec_context_set_flags (context,
+      AV_CODEC_FLAG_OUTPUT_CORRUPT, ffmpegdec->output_corrupt);
+
+  GST_DEBUG_OBJECT (ffmpegdec, "adopted cached codec context %p", context);
+
+  return TRUE;
+}
+
+/* Hand the opened context over to the cache, leaving a fresh one behind.
+ * with LOCK */
+static void
+gst_ffmpegviddec_cache_context (GstFFMpegVidDec * ffmpegdec)
+{
+  GstFFMpegVidDecClass *oclass;
+
+  oclass = (GstFFMpegVidDecClass *) (G_OBJECT_GET_CLASS (ffmpegdec));
+
+  if (!ffmpegdec->opened || ffmpegdec->context_cache_time == 0 ||
+      ffmpegdec->context_key == NULL)
+    return;
+
+  avcodec_flush_buffers (ffmpegdec->context);
+  av_frame_unref (ffmpegdec->picture);
+
+  /* pictures we allocated that the codec still holds on to would call back
+   * into this instance once released */
+  if (g_atomic_int_get (&ffmpegdec->n_video_frames) > 0) {
+    GST_DEBUG_OBJECT (ffmpegdec, "codec still holds %d pictures, not caching",
+        g_atomic_int_get (&ffmpegdec->n_video_frames));
+    return;
+  }
+
+  /* nothing of this instance may stick to the context */
+  ffmpegdec->context->opaque = NULL;
+  ffmpegdec->context->draw_horiz_band = NULL;
+  ffmpegdec->context->skip_frame = AVDISCARD_DEFAULT;
+  ffmpegdec->context->skip_loop_filter = AVDISCARD_DEFAULT;
+  ffmpegdec->context->skip_idct = AVDISCARD_DEFAULT;
+  ffmpegdec->context->debug_mv = 0;
+  gst_ffmpeg_avcodec_cache_push (ffmpegdec->context, ffmpegdec->context_key,
+      ffmpegdec->context_cache_time);
+
+  ffmpegdec->context = avcodec_alloc_context3 (oclass->in_plugin);
+  ffmpegdec->context->opaque = ffmpegdec;
+  ffmpegdec->opened = FALSE;
+}
+
+/* Returns the largest value of @field downstream can accept in @s, or 0 if
+ * it doesn't restrict it */
+static gint
+gst_ffmpegviddec_max_size_field (const GstStructure * s, const gchar * field)
 {
-  GstFFMpegVidDecClass *oclass;
-  guint i;
-
-  oclass = (GstFFMpegVidDecClass *) (G_OBJECT_GET_CLASS (ffmpegdec));
+  const GValue *v = gst_structure_get_value (s, field);
 
-  if (gst_ffmpeg_avcodec_open (ffmpegdec->context, oclass->in_plugin) < 0)
-    goto could_not_open;
+  if (v == NULL)
+    return 0;
+  if (G_VALUE_HOLDS_INT (v))
+    return g_value_get_int (v);
+  if (GST_VALUE_HOLDS_INT_RANGE (v)
+      && gst_value_get_int_range_max (v) < G_MAXINT)
+    return gst_value_get_int_range_max (v);
 
-  for (i = 0; i < G_N_ELEMENTS (ffmpegdec->stride); i++)
-    ffmpegdec->stride[i] = -1;
+  return 0;
+}
 
-  ffmpegdec->opened = TRUE;
+/* Finds the largest picture size downstream can make use of. Returns FALSE
+ * if downstream takes any size, as is the case when there is a scaler. */
+static gboolean
+gst_ffmpegviddec_get_downstream_size (GstFFMpegVidDec * ffmpegdec,
+    gint * width, gint * height)
+{
+  GstCaps *caps;
+  guint i;
 
-  GST_LOG_OBJECT (ffmpegdec, "Opened libav codec %s, id %d",
-      oclass->in_plugin->name, oclass->in_plugin->id);
+  *width = *height = 0;
 
-  gst_ffmpegviddec_context_set_flags (ffmpegdec->context,
-      AV_CODEC_FLAG_OUTPUT_CORRUPT, ffmpegdec->output_corrupt);
+  caps = gst_pad_peer_query_caps (GST_VIDEO_DECODER_SRC_PAD (ffmpegdec),
+      NULL);
+  if (caps == NULL)
+    return FALSE;
 
-  return TRUE;
+  for (i = 0; i < gst_caps_get_size (caps); i++) {
+    GstStructure *s = gst_caps_get_structure (caps, i);
+    gint w = gst_ffmpegviddec_max_size_field (s, "width");
+    gint h = gst_ffmpegviddec_max_size_field (s, "height");
 
-  /* ERRORS */
-could_not_open:
-  {
-    gst_ffmpegviddec_close (ffmpegdec, TRUE);
-    GST_DEBUG_OBJECT (ffmpegdec, "avdec_%s: Failed to open libav codec",
-        oclass->in_plugin->name);
-    return FALSE;
+    if (w == 0 || h == 0) {
+      *width = *height = 0;
+      break;
+    }
+    *width = MAX (*width, w);
+    *height = MAX (*height, h);
   }
+  gst_caps_unref (caps);
+
+  GST_DEBUG_OBJECT (ffmpegdec, "downstream size %dx%d", *width, *height);
+
+  return *width > 0 && *height > 0;
 }
 
-static void
-gst_ffmpegviddec_get_palette (GstFFMpegVidDec * ffmpegdec,
-    GstVideoCodecState * state)
+/* Picks the largest lowres factor the codec supports at which a
+ * @width x @height stream still decodes to at least @target_width x
+ * @target_height */
+static gint
+gst_ffmpegviddec_pick_lowres (GstFFMpegVidDec * ffmpegdec, gint width,
+    gint height, gint target_width, gint target_height)
 {
-  GstStructure *str = gst_caps_get_structure (state->caps, 0);
-  const GValue *palette_v;
-  GstBuffer *palette;
+  GstFFMpegVidDecClass *oclass;
+  gint lowres = 0;
 
-  /* do we have a palette? */
-  if ((palette_v = gst_structure_get_value (str, "palette_data"))) {
-    palette = gst_value_get_buffer (palette_v);
-    GST_DEBUG ("got palette data %p", palette);
-    if (gst_buffer_get_size (palette) >= AVPALETTE_SIZE) {
-      gst_buffer_replace (&ffmpegdec->palette, palette);
-    }
+  oclass = (GstFFMpegVidDecClass *) (G_OBJECT_GET_CLASS (ffmpegdec));
+
+  if (width <= 0 || height <= 0 || target_width <= 0 || target_height <= 0)
+    return 0;
+
+  while (lowres < oclass->in_plugin->max_lowres) {
+    gint next = lowres + 1;
+
+    if (((width + (1 << next) - 1) >> next) < target_width ||
+        ((height + (1 << next) - 1) >> next) < target_height)
+      break;
+    lowres = next;
   }
-}
 
+  GST_DEBUG_OBJECT (ffmpegdec, "lowres %d for %dx%d to %dx%d (max %d)",
+      lowres, width, height, target_width, target_height,
+      oclass->in_plugin->max_lowres);
+
+  return lowres;
+}
 
 static gboolean
 gst_ffmpegviddec_set_format (GstVideoDecoder * decoder,
@@ -439,6 +1551,7 @@ gst_ffmpegviddec_set_format (GstVideoDecoder * decoder,
   GstFFMpegVidDec *ffmpegdec;
   GstFFMpegVidDecClass *oclass;
   GstClockTime latency = GST_CLOCK_TIME_NONE;
+  gint target_width = 0, target_height = 0;
   gboolean ret = FALSE;
 
   ffmpegdec = (GstFFMpegVidDec *) decoder;
@@ -451,6 +1564,14 @@ gst_ffmpegviddec_set_format (GstVideoDecoder * decoder,
 
   GST_DEBUG_OBJECT (ffmpegdec, "setcaps called");
 
+  /* cached pictures belong to the previous stream configuration */
+  gst_ffmpegviddec_scrub_clear (ffmpegdec);
+
+  /* queried without the lock, downstream may call back into us */
+  if (ffmpegdec->thumbnail || ffmpegdec->lowres == LOWRES_AUTO)
+    gst_ffmpegviddec_get_downstream_size (ffmpegdec, &target_width,
+        &target_height);
+
   GST_OBJECT_LOCK (ffmpegdec);
   /* stupid check for VC1 */
   if ((oclass->in_plugin->id == AV_CODEC_ID_WMV3) ||
@@ -459,26 +1580,33 @@ gst_ffmpegviddec_set_format (GstVideoDecoder * decoder,
 
   /* close old session */
   if (ffmpegdec->opened) {
+    gboolean reuse = gst_ffmpegviddec_can_reuse_context (ffmpegdec,
+        state->caps);
+
     GST_OBJECT_UNLOCK (ffmpegdec);
+    /* also flushes the codec */
     gst_ffmpegviddec_finish (decoder);
     GST_OBJECT_LOCK (ffmpegdec);
+    gst_ffmpegviddec_reset_picture_state (ffmpegdec);
+
+    if (reuse) {
+      guint i;
+
+      GST_DEBUG_OBJECT (ffmpegdec, "keeping codec open for new caps");
+      /* nothing is referenced anymore after the flush, so the next
+       * pictures may use a new stride just like after opening */
+      for (i = 0; i < G_N_ELEMENTS (ffmpegdec->stride); i++)
+        ffmpegdec->stride[i] = -1;
+      gst_caps_replace (&ffmpegdec->last_caps, state->caps);
+      gst_ffmpegviddec_update_reused_context (ffmpegdec, state->caps);
+      gst_ffmpegviddec_get_palette (ffmpegdec, state);
+      goto opened;
+    }
+
     if (!gst_ffmpegviddec_close (ffmpegdec, TRUE)) {
       GST_OBJECT_UNLOCK (ffmpegdec);
       return FALSE;
     }
-    ffmpegdec->pic_pix_fmt = 0;
-    ffmpegdec->pic_width = 0;
-    ffmpegdec->pic_height = 0;
-    ffmpegdec->pic_par_n = 0;
-    ffmpegdec->pic_par_d = 0;
-    ffmpegdec->pic_interlaced = 0;
-    ffmpegdec->pic_field_order = 0;
-    ffmpegdec->pic_field_order_changed = FALSE;
-    ffmpegdec->ctx_ticks = 0;
-    ffmpegdec->ctx_time_n = 0;
-    ffmpegdec->ctx_time_d = 0;
-    ffmpegdec->cur_multiview_mode = GST_VIDEO_MULTIVIEW_MODE_NONE;
-    ffmpegdec->cur_multiview_flags = GST_VIDEO_MULTIVIEW_FLAGS_NONE;
   }
 
   gst_caps_replace (&ffmpegdec->last_caps, state->caps);
@@ -516,14 +1644,28 @@ gst_ffmpegviddec_set_format (GstVideoDecoder * decoder,
   ffmpegdec->context->workaround_bugs |= FF_BUG_AUTODETECT;
   ffmpegdec->context->err_recognition = 1;
 
-  /* for slow cpus */
-  ffmpegdec->context->lowres = ffmpegdec->lowres;
+  /* for slow cpus, or when downstream wants a smaller picture anyway */
+  if (ffmpegdec->thumbnail || ffmpegdec->lowres == LOWRES_AUTO)
+    ffmpegdec->context->lowres = gst_ffmpegviddec_pick_lowres (ffmpegdec,
+        ffmpegdec->context->width, ffmpegdec->context->height, target_width,
+        target_height);
+  else
+    ffmpegdec->context->lowres = ffmpegdec->lowres;
   ffmpegdec->context->skip_frame = ffmpegdec->skip_frame;
 
+  /* thumbnail mode: only keyframes, no loop filter */
+  if (ffmpegdec->thumbnail) {
+    ffmpegdec->context->skip_frame = AVDISCARD_NONKEY;
+    ffmpegdec->context->skip_loop_filter = AVDISCARD_ALL;
+    ffmpegdec->trick_skip = AVDISCARD_NONKEY;
+  }
+
   /* ffmpeg can draw motion vectors on top of the image (not every decoder
    * supports it) */
   ffmpegdec->context->debug_mv = ffmpegdec->debug_mv;
 
+  ffmpegdec->frame_thread_cap = 0;
+  ffmpegdec->latency_reopen = FALSE;
   if (ffmpegdec->thread_type) {
     GST_DEBUG_OBJECT (ffmpegdec, "Use requested thread type 0x%x",
         ffmpegdec->thread_type);
@@ -531,6 +1673,7 @@ gst_ffmpegviddec_set_format (GstVideoDecoder * decoder,
   } else {
     GstQuery *query;
     gboolean is_live;
+    gint reorder;
 
     query = gst_query_new_latency ();
     is_live = FALSE;
@@ -541,13 +1684,29 @@ gst_ffmpegviddec_set_format (GstVideoDecoder * decoder,
     }
     gst_query_unref (query);
 
-    if (is_live)
-      ffmpegdec->context->thread_type = FF_THREAD_SLICE;
-    else
+    /* libav only knows the reordering delay once it decoded some frames, so
+     * use the one seen before reopening */
+    reorder = MAX (ffmpegdec->context->has_b_frames, ffmpegdec->reorder_frames);
+
+    if (!is_live) {
       ffmpegdec->context->thread_type = FF_THREAD_SLICE | FF_THREAD_FRAME;
+    } else if (ffmpegdec->max_latency_frames - reorder >= 2) {
+      /* Every frame thread adds one frame of latency on top of the
+       * reordering delay, so allow as many as fit in the budget */
+      ffmpegdec->frame_thread_cap = ffmpegdec->max_latency_frames - reorder;
+      ffmpegdec->context->thread_type = FF_THREAD_SLICE | FF_THREAD_FRAME;
+      GST_DEBUG_OBJECT (ffmpegdec, "live upstream, using at most %d frame "
+          "threads", ffmpegdec->frame_thread_cap);
+    } else {
+      ffmpegdec->context->thread_type = FF_THREAD_SLICE;
+    }
   }
 
-  if (ffmpegdec->max_threads == 0) {
+  if (ffmpegdec->adaptive_threads) {
+    if (ffmpegdec->adaptive_thread_count == 0)
+      ffmpegdec->adaptive_thread_count = 1;
+    ffmpegdec->context->thread_count = ffmpegdec->adaptive_thread_count;
+  } else if (ffmpegdec->max_threads == 0) {
     /* When thread type is FF_THREAD_FRAME, extra latency is introduced equal
      * to one frame per thread. We thus need to calculate the thread count ourselves */
     if ((!(oclass->in_plugin->capabilities & AV_CODEC_CAP_AUTO_THREADS)) ||
@@ -559,12 +1718,27 @@ gst_ffmpegviddec_set_format (GstVideoDecoder * decoder,
   } else
     ffmpegdec->context->thread_count = ffmpegdec->max_threads;
 
+  if (ffmpegdec->frame_thread_cap > 0 &&
+      ffmpegdec->context->thread_count > ffmpegdec->frame_thread_cap) {
+    ffmpegdec->context->thread_count = ffmpegdec->frame_thread_cap;
+    if (ffmpegdec->adaptive_threads)
+      ffmpegdec->adaptive_thread_count = ffmpegdec->frame_thread_cap;
+  }
+
+  /* the parallel contexts do all the decoding then */
+  if (gst_ffmpegviddec_can_decode_parallel (ffmpegdec))
+    ffmpegdec->context->thread_count = 1;
+
   /* open codec - we don't select an output pix_fmt yet,
    * simply because we don't know! We only get it
    * during playback... */
-  if (!gst_ffmpegviddec_open (ffmpegdec))
+  if (!gst_ffmpegviddec_adopt_cached_context (ffmpegdec, state) &&
+      !gst_ffmpegviddec_open (ffmpegdec))
     goto open_failed;
 
+  gst_ffmpegviddec_parallel_start (ffmpegdec);
+
+opened:
   if (ffmpegdec->input_state)
     gst_video_codec_state_unref (ffmpegdec->input_state);
   ffmpegdec->input_state = gst_video_codec_state_ref (state);
@@ -619,6 +1793,7 @@ gst_ffmpegviddec_video_frame_new (GstFFMpegVidDec * ffmpegdec,
   dframe = g_slice_new0 (GstFFMpegVidDecVideoFrame);
   dframe->ffmpegdec = ffmpegdec;
   dframe->frame = frame;
+  g_atomic_int_inc (&ffmpegdec->n_video_frames);
 
   GST_DEBUG_OBJECT (ffmpegdec, "new video frame %p", dframe);
 
@@ -639,6 +1814,7 @@ gst_ffmpegviddec_video_frame_free (GstFFMpegVidDec * ffmpegdec,
     av_buffer_unref (&frame->avbuffer);
   }
   g_slice_free (GstFFMpegVidDecVideoFrame, frame);
+  g_atomic_int_dec_and_test (&ffmpegdec->n_video_frames);
 }
 
 static void
@@ -718,7 +1894,7 @@ gst_ffmpegviddec_ensure_internal_pool (GstFFMpegVidDec * ffmpegdec,
   GstVideoFormat format;
   GstCaps *caps;
   GstStructure *config;
-  guint i;
+  guint i, min_buffers;
 
   format = gst_ffmpeg_pixfmt_to_videoformat (picture->format);
 
@@ -753,10 +1929,24 @@ gst_ffmpegviddec_ensure_internal_pool (GstFFMpegVidDec * ffmpegdec,
     gst_object_unref (ffmpegdec->internal_pool);
 
   ffmpegdec->internal_pool = gst_video_buffer_pool_new ();
+  STATS_INC (ffmpegdec, pool_allocations);
   config = gst_buffer_pool_get_config (ffmpegdec->internal_pool);
 
+  /* the pictures being reordered, the reference pictures, one picture per
+   * frame thread, and the one being decoded and the one being output. The
+   * pool grows beyond that if needed, so don't pin more than a few large
+   * pictures up front */
+  min_buffers = 2 + ffmpegdec->context->has_b_frames +
+      MAX (ffmpegdec->context->refs, 1);
+  if (ffmpegdec->context->active_thread_type & FF_THREAD_FRAME)
+    min_buffers += ffmpegdec->context->thread_count;
+  min_buffers = MIN (min_buffers, INTERNAL_POOL_MAX_MIN_BUFFERS);
+  if (info.size > 0)
+    min_buffers = CLAMP (INTERNAL_POOL_MAX_PREALLOC / info.size, 2,
+        min_buffers);
+
   caps = gst_video_info_to_caps (&info);
-  gst_buffer_pool_config_set_params (config, caps, info.size, 2, 0);
+  gst_buffer_pool_config_set_params (config, caps, info.size, min_buffers, 0);
   gst_buffer_pool_config_set_allocator (config, NULL, &params);
   gst_buffer_pool_config_add_option (config, GST_BUFFER_POOL_OPTION_VIDEO_META);
 
@@ -789,6 +1979,28 @@ gst_ffmpegviddec_can_direct_render (GstFFMpegVidDec * ffmpegdec)
       AV_CODEC_CAP_DR1);
 }
 
+/* Buffers of the internal pool carry a GstVideoMeta, so they can be pushed
+ * as they are when downstream takes video meta and they match the output
+ * format */
+static gboolean
+gst_ffmpegviddec_can_push_internal (GstFFMpegVidDec * ffmpegdec)
+{
+  GstVideoInfo *info;
+
+  if (ffmpegdec->output_state == NULL || !ffmpegdec->have_videometa
+      || ffmpegdec->sws_context)
+    return FALSE;
+
+  info = &ffmpegdec->output_state->info;
+
+  return GST_VIDEO_INFO_FORMAT (info) ==
+      GST_VIDEO_INFO_FORMAT (&ffmpegdec->pool_info)
+      && GST_VIDEO_INFO_WIDTH (info) ==
+      GST_VIDEO_INFO_WIDTH (&ffmpegdec->pool_info)
+      && GST_VIDEO_INFO_HEIGHT (info) ==
+      GST_VIDEO_INFO_HEIGHT (&ffmpegdec->pool_info);
+}
+
 /* called when ffmpeg wants us to allocate a buffer to write the decoded frame
  * into. We try to give it memory from our pool */
 static int
@@ -812,8 +2024,11 @@ gst_ffmpegviddec_get_buffer2 (AVCodecContext * context, AVFrame * picture,
   GST_DEBUG_OBJECT (ffmpegdec, "opaque value SN %d",
       (gint32) picture->reordered_opaque);
 
-  frame =
-      gst_video_decoder_get_frame (GST_VIDEO_DECODER (ffmpegdec),
+  /* only decoded as reference for what follows the scrub cache */
+  if (picture->reordered_opaque == SCRUB_REPLAY_OPAQUE)
+    return avcodec_default_get_buffer2 (context, picture, flags);
+
+  frame = gst_ffmpegviddec_get_pending_frame (ffmpegdec,
       picture->reordered_opaque);
   if (G_UNLIKELY (frame == NULL))
     goto no_frame;
@@ -837,7 +2052,10 @@ gst_ffmpegviddec_get_buffer2 (AVCodecContext * context, AVFrame * picture,
 
   GST_DEBUG_OBJECT (ffmpegdec, "storing opaque %p", dframe);
 
-  if (!gst_ffmpegviddec_can_direct_render (ffmpegdec))
+  /* the parallel contexts run without the stream lock, keep them away
+   * from the pool handling */
+  if (!gst_ffmpegviddec_can_direct_render (ffmpegdec)
+      || context != ffmpegdec->context)
     goto no_dr;
 
   gst_ffmpegviddec_ensure_internal_pool (ffmpegdec, picture);
@@ -904,7 +2122,8 @@ no_dr:
 
     GST_LOG_OBJECT (ffmpegdec, "direct rendering disabled, fallback alloc");
 
-    for (c = 0; c < AV_NUM_DATA_POINTERS; c++) {
+    for (c = 0; c < AV_NUM_DATA_POINTERS && context == ffmpegdec->context;
+        c++) {
       ffmpegdec->stride[c] = picture->linesize[c];
     }
     /* Wrap our buffer around the default one to be able to have a callback
@@ -1183,6 +2402,145 @@ content_light_metadata_av_to_gst (AVContentLightMetadata * av,
   return TRUE;
 }
 
+static void
+gst_ffmpegviddec_clear_conversion (GstFFMpegVidDec * ffmpegdec)
+{
+  if (ffmpegdec->sws_context)
+    sws_freeContext (ffmpegdec->sws_context);
+  ffmpegdec->sws_context = NULL;
+}
+
+/* Sets up libswscale to convert the current pictures to @format at @width x
+ * @height, sliced over the decoder threads where libswscale can do that */
+static gboolean
+gst_ffmpegviddec_setup_conversion (GstFFMpegVidDec * ffmpegdec,
+    GstVideoFormat format, gint width, gint height)
+{
+  enum AVPixelFormat pix_fmt = gst_ffmpeg_videoformat_to_pixfmt (format);
+  struct SwsContext *sws;
+
+  if (pix_fmt == AV_PIX_FMT_NONE
+      || !sws_isSupportedInput (ffmpegdec->pic_pix_fmt)
+      || !sws_isSupportedOutput (pix_fmt))
+    return FALSE;
+
+  sws = sws_alloc_context ();
+  if (sws == NULL)
+    return FALSE;
+
+  av_opt_set_int (sws, "srcw", ffmpegdec->pic_width, 0);
+  av_opt_set_int (sws, "srch", ffmpegdec->pic_height, 0);
+  av_opt_set_pixel_fmt (sws, "src_format", ffmpegdec->pic_pix_fmt, 0);
+  av_opt_set_int (sws, "dstw", width, 0);
+  av_opt_set_int (sws, "dsth", height, 0);
+  av_opt_set_pixel_fmt (sws, "dst_format", pix_fmt, 0);
+  av_opt_set_int (sws, "sws_flags", SWS_BILINEAR, 0);
+#if LIBSWSCALE_VERSION_INT >= AV_VERSION_INT (6, 1, 100)
+  av_opt_set_int (sws, "threads", MAX (ffmpegdec->context->thread_count, 1),
+      0);
+#endif
+
+  if (sws_init_context (sws, NULL, NULL) < 0) {
+    sws_freeContext (sws);
+    return FALSE;
+  }
+
+  ffmpegdec->sws_context = sws;
+
+  return TRUE;
+}
+
+/* When downstream can't take the pictures as @format at @width x @height,
+ * picks the format and size closest to that it takes instead and sets up
+ * converting to them while copying the pictures out. This saves the
+ * separate passes of a converter and a scaler after the decoder. */
+static void
+gst_ffmpegviddec_update_conversion (GstFFMpegVidDec * ffmpegdec,
+    GstVideoFormat * format, gint * width, gint * height)
+{
+  GstPad *srcpad = GST_VIDEO_DECODER_SRC_PAD (ffmpegdec);
+  GstCaps *templ, *peer, *caps;
+  GstStructure *s;
+  GstVideoInfo info;
+
+  gst_ffmpegviddec_clear_conversion (ffmpegdec);
+
+  /* libswscale would scale the fields of interlaced pictures together */
+  if (!ffmpegdec->output_conversion || ffmpegdec->pic_interlaced ||
+      GST_VIDEO_INFO_IS_INTERLACED (&ffmpegdec->input_state->info))
+    return;
+
+  templ = gst_pad_get_pad_template_caps (srcpad);
+  peer = gst_pad_peer_query_caps (srcpad, templ);
+  gst_caps_unref (templ);
+
+  if (gst_caps_is_empty (peer) || gst_caps_is_any (peer))
+    goto done;
+
+  caps = gst_caps_new_simple ("video/x-raw",
+      "format", G_TYPE_STRING, gst_video_format_to_string (*format),
+      "width", G_TYPE_INT, *width, "height", G_TYPE_INT, *height, NULL);
+  if (gst_caps_can_intersect (caps, peer)) {
+    gst_caps_unref (caps);
+    goto done;
+  }
+  gst_caps_unref (caps);
+
+  peer = gst_caps_truncate (peer);
+  s = gst_caps_get_structure (peer, 0);
+  gst_structure_fixate_field_string (s, "format",
+      gst_video_format_to_string (*format));
+  gst_structure_fixate_field_nearest_int (s, "width", *width);
+  gst_structure_fixate_field_nearest_int (s, "height", *height);
+  peer = gst_caps_fixate (peer);
+
+  if (!gst_video_info_from_caps (&info, peer))
+    goto done;
+
+  if (!gst_ffmpegviddec_setup_conversion (ffmpegdec,
+          GST_VIDEO_INFO_FORMAT (&info), GST_VIDEO_INFO_WIDTH (&info),
+          GST_VIDEO_INFO_HEIGHT (&info))) {
+    GST_DEBUG_OBJECT (ffmpegdec, "can't convert to %" GST_PTR_FORMAT, peer);
+    goto done;
+  }
+
+  GST_DEBUG_OBJECT (ffmpegdec, "converting %s %dx%d to %s %dx%d",
+      gst_video_format_to_string (*format), *width, *height,
+      GST_VIDEO_INFO_NAME (&info), GST_VIDEO_INFO_WIDTH (&info),
+      GST_VIDEO_INFO_HEIGHT (&info));
+
+  *format = GST_VIDEO_INFO_FORMAT (&info);
+  *width = GST_VIDEO_INFO_WIDTH (&info);
+  *height = GST_VIDEO_INFO_HEIGHT (&info);
+
+done:
+  gst_caps_unref (peer);
+}
+
+/* The frame threads of live streams are capped with the reordering delay
+ * known when opening, which is usually none yet. Once libav reports a larger
+ * one, reopen on the next keyframe so that set_format() caps them again */
+static void
+gst_ffmpegviddec_update_reorder_frames (GstFFMpegVidDec * ffmpegdec)
+{
+  gint reorder = ffmpegdec->context->has_b_frames;
+
+  if (G_LIKELY (reorder <= ffmpegdec->reorder_frames))
+    return;
+
+  ffmpegdec->reorder_frames = reorder;
+  if (ffmpegdec->frame_thread_cap == 0 ||
+      reorder + ffmpegdec->context->thread_count <=
+      ffmpegdec->max_latency_frames)
+    return;
+
+  GST_INFO_OBJECT (ffmpegdec, "latency of %d frames exceeds the configured "
+      "maximum of %d frames, reducing the frame threads at the next keyframe",
+      reorder + ffmpegdec->context->thread_count,
+      ffmpegdec->max_latency_frames);
+  ffmpegdec->latency_reopen = TRUE;
+}
+
 static gboolean
 gst_ffmpegviddec_negotiate (GstFFMpegVidDec * ffmpegdec,
     AVCodecContext * context, AVFrame * picture)
@@ -1190,6 +2548,7 @@ gst_ffmpegviddec_negotiate (GstFFMpegVidDec * ffmpegdec,
   GstVideoFormat fmt;
   GstVideoInfo *in_info, *out_info;
   GstVideoCodecState *output_state;
+  gint width, height;
   gint fps_n, fps_d;
   GstClockTime latency;
   GstStructure *in_s;
@@ -1201,9 +2560,16 @@ gst_ffmpegviddec_negotiate (GstFFMpegVidDec * ffmpegdec,
   if (G_UNLIKELY (fmt == GST_VIDEO_FORMAT_UNKNOWN))
     goto unknown_format;
 
+  width = ffmpegdec->pic_width;
+  height = ffmpegdec->pic_height;
+  gst_ffmpegviddec_update_conversion (ffmpegdec, &fmt, &width, &height);
+
+  /* the cached pictures don't match the new output anymore */
+  gst_ffmpegviddec_scrub_clear (ffmpegdec);
+
   output_state =
       gst_video_decoder_set_output_state (GST_VIDEO_DECODER (ffmpegdec), fmt,
-      ffmpegdec->pic_width, ffmpegdec->pic_height, ffmpegdec->input_state);
+      width, height, ffmpegdec->input_state);
   if (ffmpegdec->output_state)
     gst_video_codec_state_unref (ffmpegdec->output_state);
   ffmpegdec->output_state = output_state;
@@ -1311,6 +2677,12 @@ gst_ffmpegviddec_negotiate (GstFFMpegVidDec * ffmpegdec,
   /* calculate and update par now */
   gst_ffmpegviddec_update_par (ffmpegdec, in_info, out_info);
 
+  /* keep the display aspect ratio when scaling */
+  if (width != ffmpegdec->pic_width || height != ffmpegdec->pic_height)
+    gst_util_fraction_multiply (out_info->par_n, out_info->par_d,
+        ffmpegdec->pic_width * height, ffmpegdec->pic_height * width,
+        &out_info->par_n, &out_info->par_d);
+
   GST_VIDEO_INFO_MULTIVIEW_MODE (out_info) = ffmpegdec->cur_multiview_mode;
   GST_VIDEO_INFO_MULTIVIEW_FLAGS (out_info) = ffmpegdec->cur_multiview_flags;
 
@@ -1415,38 +2787,131 @@ negotiate_failed:
   }
 }
 
+/* Applies the decoding shortcuts of a QoS level to the codec context. Each
+ * level includes the shortcuts of the previous ones. Trick modes and the
+ * thumbnail mode skip at least the frames in trick_skip, pre-roll frames
+ * at least the non-reference ones. */
+static void
+gst_ffmpegviddec_apply_qos_level (GstFFMpegVidDec * ffmpegdec, gint level)
+{
+  AVCodecContext *context = ffmpegdec->context;
+
+  context->skip_loop_filter =
+      level >= QOS_LEVEL_SKIP_LOOP_FILTER
+      || ffmpegdec->thumbnail ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+  context->skip_idct =
+      level >= QOS_LEVEL_SKIP_IDCT ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+
+  if (level >= QOS_LEVEL_SKIP_NONKEY)
+    context->skip_frame = AVDISCARD_NONKEY;
+  else if (level >= QOS_LEVEL_SKIP_NONREF)
+    context->skip_frame = MAX (ffmpegdec->skip_frame, AVDISCARD_NONREF);
+  else
+    context->skip_frame = ffmpegdec->skip_frame;
+
+  context->skip_frame = MAX (context->skip_frame, ffmpegdec->trick_skip);
+  if (ffmpegdec->preroll)
+    context->skip_frame = MAX (context->skip_frame, AVDISCARD_NONREF);
+}
+
+/* Back to the normal QoS level without trick mode or pre-roll skipping,
+ * after a flush or before stopping */
+static void
+gst_ffmpegviddec_reset_qos (GstFFMpegVidDec * ffmpegdec)
+{
+  ffmpegdec->qos_level = QOS_LEVEL_NORMAL;
+  ffmpegdec->trick_skip = AVDISCARD_DEFAULT;
+  ffmpegdec->preroll = FALSE;
+  /* do_qos() only applies changes */
+  if (ffmpegdec->opened)
+    gst_ffmpegviddec_apply_qos_level (ffmpegdec, QOS_LEVEL_NORMAL);
+}
+
+/* Returns TRUE if @frame ends before the start of the segment, like the
+ * frames from the keyframe up to the target of an accurate seek. These are
+ * clipped by the base class. */
+static gboolean
+gst_ffmpegviddec_before_segment (GstFFMpegVidDec * ffmpegdec,
+    GstVideoCodecFrame * frame)
+{
+  GstSegment *segment = &GST_VIDEO_DECODER_INPUT_SEGMENT (ffmpegdec);
+
+  if (frame == NULL || segment->format != GST_FORMAT_TIME
+      || segment->rate < 0.0 || !GST_CLOCK_TIME_IS_VALID (frame->pts)
+      || !GST_CLOCK_TIME_IS_VALID (frame->duration))
+    return FALSE;
+
+  return frame->pts + frame->duration <= segment->start;
+}
+
+static void
+gst_ffmpegviddec_set_qos_level (GstFFMpegVidDec * ffmpegdec, gint level,
+    GstClockTimeDiff diff)
+{
+  gint old_level = ffmpegdec->qos_level;
+
+  if (level == old_level)
+    return;
+
+  GST_DEBUG_OBJECT (ffmpegdec, "QOS: level %d -> %d, diff %" G_GINT64_FORMAT,
+      old_level, level, diff);
+
+  ffmpegdec->qos_level = level;
+  ffmpegdec->qos_frames_since_change = 0;
+  ffmpegdec->qos_early_frames = 0;
+  gst_ffmpegviddec_apply_qos_level (ffmpegdec, level);
+
+  gst_element_post_message (GST_ELEMENT_CAST (ffmpegdec),
+      gst_message_new_element (GST_OBJECT_CAST (ffmpegdec),
+          gst_structure_new ("avviddec-qos",
+              "level", GST_FFMPEGVIDDEC_TYPE_QOS_LEVEL, level,
+              "previous-level", GST_FFMPEGVIDDEC_TYPE_QOS_LEVEL, old_level,
+              "jitter", G_TYPE_INT64, (gint64) - diff,
+              "dropped", G_TYPE_UINT64, ffmpegdec->qos_dropped, NULL)));
+}
+
 /* perform qos calculations before decoding the next frame.
  *
- * Sets the skip_frame flag and if things are really bad, skips to the next
- * keyframe.
+ * Escalates through the QoS levels one at a time while we are late, giving
+ * each level some frames to take effect, and only goes back down once we
+ * have been early for a while, so that playback doesn't oscillate.
  *
+ * Returns: %TRUE if @frame should be dropped without decoding it
  */
-static void
+static gboolean
 gst_ffmpegviddec_do_qos (GstFFMpegVidDec * ffmpegdec,
-    GstVideoCodecFrame * frame, gboolean * mode_switch)
+    GstVideoCodecFrame * frame)
 {
   GstClockTimeDiff diff;
   GstSegmentFlags skip_flags =
       GST_VIDEO_DECODER_INPUT_SEGMENT (ffmpegdec).flags;
-
-  *mode_switch = FALSE;
+  enum AVDiscard trick_skip = AVDISCARD_DEFAULT;
+  gint level;
 
   if (frame == NULL)
-    return;
+    return FALSE;
 
-  if (skip_flags & GST_SEGMENT_FLAG_TRICKMODE_KEY_UNITS) {
-    ffmpegdec->context->skip_frame = AVDISCARD_NONKEY;
-    *mode_switch = TRUE;
-  } else if (skip_flags & GST_SEGMENT_FLAG_TRICKMODE) {
-    ffmpegdec->context->skip_frame = AVDISCARD_NONREF;
-    *mode_switch = TRUE;
+  if (ffmpegdec->thumbnail
+      || (skip_flags & GST_SEGMENT_FLAG_TRICKMODE_KEY_UNITS))
+    trick_skip = AVDISCARD_NONKEY;
+  else if (skip_flags & GST_SEGMENT_FLAG_TRICKMODE)
+    trick_skip = AVDISCARD_NONREF;
+
+  /* also restores the normal skipping when the trick mode ends */
+  if (trick_skip != ffmpegdec->trick_skip) {
+    GST_DEBUG_OBJECT (ffmpegdec, "trick mode skipping %d -> %d",
+        ffmpegdec->trick_skip, trick_skip);
+    ffmpegdec->trick_skip = trick_skip;
+    gst_ffmpegviddec_apply_qos_level (ffmpegdec, ffmpegdec->qos_level);
   }
 
-  if (*mode_switch == TRUE) {
-    /* We've already switched mode, we can return straight away
-     * without any further calculation */
-    return;
-  }
+  /* libav would discard everything but keyframes anyway, so don't even
+   * hand delta units to it. With keyframe trick mode seeks upstream
+   * usually only sends keyframes in the first place. */
+  if (trick_skip == AVDISCARD_NONKEY)
+    return !GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame);
+  else if (trick_skip != AVDISCARD_DEFAULT)
+    return FALSE;
 
   diff =
       gst_video_decoder_get_max_decode_time (GST_VIDEO_DECODER (ffmpegdec),
@@ -1455,26 +2920,177 @@ gst_ffmpegviddec_do_qos (GstFFMpegVidDec * ffmpegdec,
   /* if we don't have timing info, then we don't do QoS */
   if (G_UNLIKELY (diff == G_MAXINT64)) {
     /* Ensure the skipping strategy is the default one */
-    ffmpegdec->context->skip_frame = ffmpegdec->skip_frame;
-    return;
+    gst_ffmpegviddec_set_qos_level (ffmpegdec, QOS_LEVEL_NORMAL, 0);
+    gst_ffmpegviddec_apply_qos_level (ffmpegdec, QOS_LEVEL_NORMAL);
+    return FALSE;
   }
 
   GST_DEBUG_OBJECT (ffmpegdec, "decoding time %" G_GINT64_FORMAT, diff);
 
-  if (diff > 0 && ffmpegdec->context->skip_frame != AVDISCARD_DEFAULT) {
-    ffmpegdec->context->skip_frame = AVDISCARD_DEFAULT;
-    *mode_switch = TRUE;
-    GST_DEBUG_OBJECT (ffmpegdec, "QOS: normal mode");
+  level = ffmpegdec->qos_level;
+  ffmpegdec->qos_frames_since_change++;
+
+  if (diff <= 0) {
+    ffmpegdec->qos_early_frames = 0;
+    if (level < QOS_LEVEL_DROP
+        && ffmpegdec->qos_frames_since_change >= QOS_HOLD_FRAMES)
+      gst_ffmpegviddec_set_qos_level (ffmpegdec, level + 1, diff);
+  } else if (level > QOS_LEVEL_NORMAL) {
+    GstClockTime margin = GST_CLOCK_TIME_IS_VALID (frame->duration) ?
+        frame->duration : QOS_RECOVER_MARGIN;
+
+    if (diff > (GstClockTimeDiff) margin)
+      ffmpegdec->qos_early_frames++;
+    else
+      ffmpegdec->qos_early_frames = 0;
+
+    if (ffmpegdec->qos_early_frames >= QOS_RECOVER_FRAMES)
+      gst_ffmpegviddec_set_qos_level (ffmpegdec, level - 1, diff);
   }
 
-  else if (diff <= 0 && ffmpegdec->context->skip_frame != AVDISCARD_NONREF) {
-    ffmpegdec->context->skip_frame = AVDISCARD_NONREF;
-    *mode_switch = TRUE;
-    GST_DEBUG_OBJECT (ffmpegdec,
-        "QOS: hurry up, diff %" G_GINT64_FORMAT " >= 0", diff);
+  /* keyframes are always decoded, we would lose everything until the next
+   * one otherwise */
+  if (ffmpegdec->qos_level >= QOS_LEVEL_DROP
+      && !GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame)) {
+    ffmpegdec->qos_dropped++;
+    STATS_INC (ffmpegdec, qos_dropped);
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+gst_ffmpegviddec_avbuffer_unref (gpointer data)
+{
+  AVBufferRef *avbuffer = data;
+
+  av_buffer_unref (&avbuffer);
+}
+
+/* Wrap the planes of the current picture in a GstBuffer without copying.
+ * Every plane memory holds a reference on the AVBufferRef backing it, so the
+ * libav buffer is only recycled once downstream releases the GstBuffer.
+ * Returns FALSE when the picture layout can't be described with a
+ * GstVideoMeta, in which case the caller has to copy. */
+static gboolean
+gst_ffmpegviddec_wrap_output_buffer (GstFFMpegVidDec * ffmpegdec,
+    GstVideoCodecFrame * frame)
+{
+  AVFrame *picture = ffmpegdec->picture;
+  GstFFMpegVidDecVideoFrame *dframe = picture->opaque;
+  const AVPixFmtDescriptor *desc;
+  GstVideoInfo *info;
+  GstBuffer *buffer;
+  gsize offset[GST_VIDEO_MAX_PLANES] = { 0, };
+  gint stride[GST_VIDEO_MAX_PLANES] = { 0, };
+  gsize total = 0;
+  guint c, n_planes;
+
+  desc = av_pix_fmt_desc_get (picture->format);
+  if (desc == NULL || (desc->flags & AV_PIX_FMT_FLAG_PAL))
+    return FALSE;
+
+  info = &ffmpegdec->output_state->info;
+  if (GST_VIDEO_INFO_WIDTH (info) != picture->width ||
+      GST_VIDEO_INFO_HEIGHT (info) != picture->height)
+    return FALSE;
+
+  n_planes = GST_VIDEO_INFO_N_PLANES (info);
+  buffer = gst_buffer_new ();
+
+  for (c = 0; c < n_planes; c++) {
+    AVBufferRef *avbuffer;
+    gint comp[GST_VIDEO_MAX_COMPONENTS];
+    gsize size;
+
+    if (picture->data[c] == NULL || picture->linesize[c] <= 0)
+      goto no_wrap;
+
+    avbuffer = av_frame_get_plane_buffer (picture, c);
+    /* buf[0] is our wrapper around the buffer libav allocated, reference the
+     * real one so that the wrapper (and the codec frame) is released as
+     * usual */
+    if (avbuffer != NULL && avbuffer == picture->buf[0] && dframe
+        && dframe->avbuffer)
+      avbuffer = dframe->avbuffer;
+    if (avbuffer == NULL || avbuffer->data == NULL)
+      goto no_wrap;
+
+    gst_video_format_info_component (info->finfo, c, comp);
+    size = (gsize) picture->linesize[c] *
+        GST_VIDEO_INFO_COMP_HEIGHT (info, comp[0]);
+    if (picture->data[c] < avbuffer->data ||
+        picture->data[c] + size > avbuffer->data + avbuffer->size)
+      goto no_wrap;
+
+    avbuffer = av_buffer_ref (avbuffer);
+    if (avbuffer == NULL)
+      goto no_wrap;
+
+    gst_buffer_append_memory (buffer,
+        gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY, picture->data[c],
+            size, 0, size, avbuffer, gst_ffmpegviddec_avbuffer_unref));
+
+    offset[c] = total;
+    stride[c] = picture->linesize[c];
+    total += size;
+  }
+
+  gst_buffer_add_video_meta_full (buffer, GST_VIDEO_FRAME_FLAG_NONE,
+      GST_VIDEO_INFO_FORMAT (info), GST_VIDEO_INFO_WIDTH (info),
+      GST_VIDEO_INFO_HEIGHT (info), n_planes, offset, stride);
+
+  GST_LOG_OBJECT (ffmpegdec, "wrapped picture in buffer %p", buffer);
+
+  gst_buffer_replace (&frame->output_buffer, NULL);
+  frame->output_buffer = buffer;
+
+  return TRUE;
+
+no_wrap:
+  {
+    GST_CAT_TRACE_OBJECT (GST_CAT_PERFORMANCE, ffmpegdec,
+        "picture plane %u can't be wrapped, copying", c);
+    gst_buffer_unref (buffer);
+    return FALSE;
   }
 }
 
+#if LIBSWSCALE_VERSION_INT >= AV_VERSION_INT (6, 1, 100)
+static void
+gst_ffmpegviddec_free_nothing (void *opaque, uint8_t * data)
+{
+}
+#endif
+
+/* Converts @src into the mapped output picture @dst of @size bytes */
+static gint
+gst_ffmpegviddec_convert_picture (GstFFMpegVidDec * ffmpegdec, AVFrame * dst,
+    AVFrame * src, gsize size)
+{
+#if LIBSWSCALE_VERSION_INT >= AV_VERSION_INT (6, 1, 100)
+  gint res;
+
+  /* only sws_scale_frame() slices over the threads, and it wants refcounted
+   * frames */
+  dst->extended_data = dst->data;
+  dst->buf[0] = av_buffer_create (dst->data[0], size,
+      gst_ffmpegviddec_free_nothing, NULL, 0);
+  if (dst->buf[0] == NULL)
+    return AVERROR (ENOMEM);
+
+  res = sws_scale_frame (ffmpegdec->sws_context, dst, src);
+  av_buffer_unref (&dst->buf[0]);
+
+  return res;
+#else
+  return sws_scale (ffmpegdec->sws_context,
+      (const uint8_t * const *) src->data, src->linesize, 0, src->height,
+      dst->data, dst->linesize);
+#endif
+}
+
 /* get an outbuf buffer with the current picture */
 static GstFlowReturn
 get_output_buffer (GstFFMpegVidDec * ffmpegdec, GstVideoCodecFrame * frame)
@@ -1490,6 +3106,14 @@ get_output_buffer (GstFFMpegVidDec * ffmpegdec, GstVideoCodecFrame * frame)
   if (!ffmpegdec->output_state)
     goto not_negotiated;
 
+  /* downstream understands video meta, push the libav planes as they are */
+  if (ffmpegdec->have_videometa && ffmpegdec->sws_context == NULL &&
+      gst_ffmpegviddec_wrap_output_buffer (ffmpegdec, frame)) {
+    ffmpegdec->picture->reordered_opaque = -1;
+    STATS_INC (ffmpegdec, wrapped_frames);
+    return GST_FLOW_OK;
+  }
+
   ret =
       gst_video_decoder_allocate_output_frame (GST_VIDEO_DECODER (ffmpegdec),
       frame);
@@ -1522,9 +3146,24 @@ get_output_buffer (GstFFMpegVidDec * ffmpegdec, GstVideoCodecFrame * frame)
 
   outpic = ffmpegdec->picture;
 
-  if (av_frame_copy (&pic, outpic) != 0) {
-    GST_ERROR_OBJECT (ffmpegdec, "Failed to copy output frame");
-    ret = GST_FLOW_ERROR;
+  /* the copy we have to do anyway doubles as the conversion */
+  if (ffmpegdec->sws_context) {
+    pic.format =
+        gst_ffmpeg_videoformat_to_pixfmt (GST_VIDEO_INFO_FORMAT (info));
+    if (gst_ffmpegviddec_convert_picture (ffmpegdec, &pic, outpic,
+            gst_buffer_get_size (frame->output_buffer)) < 0) {
+      GST_ERROR_OBJECT (ffmpegdec, "Failed to convert output frame");
+      ret = GST_FLOW_ERROR;
+    } else {
+      STATS_INC (ffmpegdec, converted_frames);
+    }
+  } else {
+    if (av_frame_copy (&pic, outpic) != 0) {
+      GST_ERROR_OBJECT (ffmpegdec, "Failed to copy output frame");
+      ret = GST_FLOW_ERROR;
+    } else {
+      STATS_INC (ffmpegdec, copied_frames);
+    }
   }
 
   gst_video_frame_unmap (&vframe);
@@ -1556,39 +3195,21 @@ not_negotiated:
   }
 }
 
-static void
-gst_avpacket_init (AVPacket * packet, guint8 * data, guint size)
-{
-  memset (packet, 0, sizeof (AVPacket));
-  packet->data = data;
-  packet->size = size;
-}
-
-/*
+/* Outputs the picture in ffmpegdec->picture, @res being what libav returned
+ * when receiving it while decoding @frame.
  * Returns: whether a frame was decoded
  */
 static gboolean
-gst_ffmpegviddec_video_frame (GstFFMpegVidDec * ffmpegdec,
-    GstVideoCodecFrame * frame, GstFlowReturn * ret)
+gst_ffmpegviddec_output_picture (GstFFMpegVidDec * ffmpegdec,
+    GstVideoCodecFrame * frame, gint res, GstFlowReturn * ret)
 {
-  gint res;
   gboolean got_frame = FALSE;
-  gboolean mode_switch;
   GstVideoCodecFrame *out_frame;
   GstFFMpegVidDecVideoFrame *out_dframe;
   GstBufferPool *pool;
 
   *ret = GST_FLOW_OK;
 
-  /* in case we skip frames */
-  ffmpegdec->picture->pict_type = -1;
-
-  /* run QoS code, we don't stop decoding the frame when we are late because
-   * else we might skip a reference frame */
-  gst_ffmpegviddec_do_qos (ffmpegdec, frame, &mode_switch);
-
-  res = avcodec_receive_frame (ffmpegdec->context, ffmpegdec->picture);
-
   /* No frames available at this time */
   if (res == AVERROR (EAGAIN))
     goto beach;
@@ -1604,6 +3225,12 @@ gst_ffmpegviddec_video_frame (GstFFMpegVidDec * ffmpegdec,
 
   got_frame = TRUE;
 
+  /* replayed from before the seek, see gst_ffmpegviddec_scrub_replay() */
+  if (G_UNLIKELY (ffmpegdec->picture->opaque == NULL)) {
+    av_frame_unref (ffmpegdec->picture);
+    goto beach;
+  }
+
   /* get the output picture timing info again */
   out_dframe = ffmpegdec->picture->opaque;
   out_frame = gst_video_codec_frame_ref (out_dframe->frame);
@@ -1612,6 +3239,16 @@ gst_ffmpegviddec_video_frame (GstFFMpegVidDec * ffmpegdec,
   gst_buffer_replace (&out_frame->output_buffer, out_dframe->buffer);
   gst_buffer_replace (&out_dframe->buffer, NULL);
 
+  /* the base class would clip the frame anyway, so don't negotiate or
+   * produce an output buffer for it. Finishing a frame without a buffer
+   * just skips it. */
+  if (G_UNLIKELY (gst_ffmpegviddec_before_segment (ffmpegdec, out_frame))) {
+    GST_LOG_OBJECT (ffmpegdec, "frame before segment start, not outputting");
+    gst_buffer_replace (&out_frame->output_buffer, NULL);
+    STATS_INC (ffmpegdec, preroll_frames);
+    goto finish;
+  }
+
   /* Extract auxilliary info not stored in the main AVframe */
   {
     GstVideoInfo *in_info = &ffmpegdec->input_state->info;
@@ -1659,25 +3296,33 @@ gst_ffmpegviddec_video_frame (GstFFMpegVidDec * ffmpegdec,
           ffmpegdec->picture))
     goto negotiation_error;
 
+  gst_ffmpegviddec_update_reorder_frames (ffmpegdec);
+
   pool = gst_video_decoder_get_buffer_pool (GST_VIDEO_DECODER (ffmpegdec));
   if (G_UNLIKELY (out_frame->output_buffer == NULL)) {
     *ret = get_output_buffer (ffmpegdec, out_frame);
+  } else if (out_frame->output_buffer->pool == ffmpegdec->internal_pool
+      && out_frame->output_buffer->pool != pool
+      && gst_ffmpegviddec_can_push_internal (ffmpegdec)) {
+    /* the downstream pool was rejected, but downstream can still take the
+     * picture where libav decoded it */
+    STATS_INC (ffmpegdec, wrapped_frames);
   } else if (G_UNLIKELY (out_frame->output_buffer->pool != pool)) {
     GstBuffer *tmp = out_frame->output_buffer;
     out_frame->output_buffer = NULL;
     *ret = get_output_buffer (ffmpegdec, out_frame);
     gst_buffer_unref (tmp);
-  }
+  } else {
 #ifndef G_DISABLE_ASSERT
-  else {
     GstVideoMeta *vmeta = gst_buffer_get_video_meta (out_frame->output_buffer);
     if (vmeta) {
       GstVideoInfo *info = &ffmpegdec->output_state->info;
       g_assert ((gint) vmeta->width == GST_VIDEO_INFO_WIDTH (info));
       g_assert ((gint) vmeta->height == GST_VIDEO_INFO_HEIGHT (info));
     }
-  }
 #endif
+    STATS_INC (ffmpegdec, dr_frames);
+  }
   gst_object_unref (pool);
 
   if (G_UNLIKELY (*ret != GST_FLOW_OK))
@@ -1722,39 +3367,42 @@ gst_ffmpegviddec_video_frame (GstFFMpegVidDec * ffmpegdec,
     }
   }
 
+  gst_ffmpegviddec_scrub_insert (ffmpegdec, out_frame);
+
+finish:
   /* cleaning time */
   /* so we decoded this frame, frames preceding it in decoding order
    * that still do not have a buffer allocated seem rather useless,
    * and can be discarded, due to e.g. misparsed bogus frame
    * or non-keyframe in skipped decoding, ...
    * In any case, not likely to be seen again, so discard those,
-   * before they pile up and/or mess with timestamping */
+   * before they pile up and/or mess with timestamping.
+   * Frames are only looked at once: a frame that got a buffer can never
+   * become a ghost again. */
   {
-    GList *l, *ol;
     GstVideoDecoder *dec = GST_VIDEO_DECODER (ffmpegdec);
-    gboolean old = TRUE;
+    GstVideoCodecFrame *tmp;
 
-    ol = l = gst_video_decoder_get_frames (dec);
-    while (l) {
-      GstVideoCodecFrame *tmp = l->data;
+    gst_ffmpegviddec_remove_pending_frame (ffmpegdec, out_frame);
 
+    while ((tmp = g_queue_peek_head (&ffmpegdec->ghost_candidates))) {
       if (tmp == frame)
-        old = FALSE;
+        break;
 
-      if (old && GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (tmp)) {
+      g_queue_pop_head (&ffmpegdec->ghost_candidates);
+
+      if (GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (tmp)) {
         GST_LOG_OBJECT (dec,
             "discarding ghost frame %p (#%d) PTS:%" GST_TIME_FORMAT " DTS:%"
             GST_TIME_FORMAT, tmp, tmp->system_frame_number,
             GST_TIME_ARGS (tmp->pts), GST_TIME_ARGS (tmp->dts));
-        /* drop extra ref and remove from frame list */
+        gst_ffmpegviddec_remove_pending_frame (ffmpegdec, tmp);
+        /* drop our ref and remove from frame list */
         gst_video_decoder_release_frame (dec, tmp);
       } else {
-        /* drop extra ref we got */
         gst_video_codec_frame_unref (tmp);
       }
-      l = l->next;
     }
-    g_list_free (ol);
   }
 
   av_frame_unref (ffmpegdec->picture);
@@ -1762,8 +3410,9 @@ gst_ffmpegviddec_video_frame (GstFFMpegVidDec * ffmpegdec,
   /* FIXME: Ideally we would remap the buffer read-only now before pushing but
    * libav might still have a reference to it!
    */
-  *ret =
-      gst_video_decoder_finish_frame (GST_VIDEO_DECODER (ffmpegdec), out_frame);
+  STATS_INC (ffmpegdec, frames_out);
+
+  *ret = gst_ffmpegviddec_finish_frame (ffmpegdec, out_frame);
 
 beach:
   GST_DEBUG_OBJECT (ffmpegdec, "return flow %s, got frame: %d",
@@ -1774,6 +3423,7 @@ beach:
 no_output:
   {
     GST_DEBUG_OBJECT (ffmpegdec, "no output buffer");
+    gst_ffmpegviddec_remove_pending_frame (ffmpegdec, out_frame);
     gst_video_decoder_drop_frame (GST_VIDEO_DECODER (ffmpegdec), out_frame);
     goto beach;
   }
@@ -1790,6 +3440,100 @@ negotiation_error:
   }
 }
 
+/*
+ * Returns: whether a frame was decoded
+ */
+static gboolean
+gst_ffmpegviddec_video_frame (GstFFMpegVidDec * ffmpegdec,
+    GstVideoCodecFrame * frame, GstFlowReturn * ret)
+{
+  GstClockTime start;
+  gint res;
+
+  /* in case we skip frames */
+  ffmpegdec->picture->pict_type = -1;
+
+  start = gst_util_get_timestamp ();
+  res = avcodec_receive_frame (ffmpegdec->context, ffmpegdec->picture);
+  ffmpegdec->frame_decode_time += gst_util_get_timestamp () - start;
+
+  return gst_ffmpegviddec_output_picture (ffmpegdec, frame, res, ret);
+}
+
+/* with STREAM_LOCK. Outputs the pictures decoded in parallel in the order
+ * their packets were sent, waiting for the oldest ones until at most
+ * @max_pending are left */
+static GstFlowReturn
+gst_ffmpegviddec_parallel_output (GstFFMpegVidDec * ffmpegdec,
+    guint max_pending)
+{
+  GstFFMpegVidDecParallelJob *job;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  g_mutex_lock (&ffmpegdec->parallel_lock);
+  while ((job = g_queue_peek_head (&ffmpegdec->parallel_jobs))) {
+    if (!job->done) {
+      if (g_queue_get_length (&ffmpegdec->parallel_jobs) <= max_pending)
+        break;
+      g_cond_wait (&ffmpegdec->parallel_cond, &ffmpegdec->parallel_lock);
+      continue;
+    }
+    g_queue_pop_head (&ffmpegdec->parallel_jobs);
+    g_mutex_unlock (&ffmpegdec->parallel_lock);
+
+    if (ret == GST_FLOW_OK && job->res == AVERROR (EAGAIN)) {
+      /* discarded by the skip settings, nothing else will finish it */
+      ret = gst_video_decoder_drop_frame (GST_VIDEO_DECODER (ffmpegdec),
+          gst_video_codec_frame_ref (job->frame));
+    } else if (ret == GST_FLOW_OK) {
+      AVFrame *picture = job->picture;
+
+      /* negotiate() looks at the main context, which decodes nothing */
+      ffmpegdec->context->color_primaries = picture->color_primaries;
+      ffmpegdec->context->color_trc = picture->color_trc;
+      ffmpegdec->context->colorspace = picture->colorspace;
+      ffmpegdec->context->color_range = picture->color_range;
+      ffmpegdec->context->chroma_sample_location = picture->chroma_location;
+
+      av_frame_move_ref (ffmpegdec->picture, picture);
+      gst_ffmpegviddec_output_picture (ffmpegdec, job->frame, job->res, &ret);
+      av_frame_unref (ffmpegdec->picture);
+    }
+    gst_ffmpegviddec_parallel_job_free (job);
+
+    g_mutex_lock (&ffmpegdec->parallel_lock);
+  }
+  g_mutex_unlock (&ffmpegdec->parallel_lock);
+
+  return ret;
+}
+
+/* with STREAM_LOCK. Hands @packet of @frame to the parallel contexts and
+ * outputs what is ready, keeping every context busy */
+static GstFlowReturn
+gst_ffmpegviddec_parallel_decode_frame (GstFFMpegVidDec * ffmpegdec,
+    GstVideoCodecFrame * frame, AVPacket * packet)
+{
+  GstFFMpegVidDecParallelJob *job;
+
+  job = g_slice_new0 (GstFFMpegVidDecParallelJob);
+  job->frame = gst_video_codec_frame_ref (frame);
+  job->packet = av_packet_alloc ();
+  job->picture = av_frame_alloc ();
+  job->skip_frame = ffmpegdec->context->skip_frame;
+  job->skip_loop_filter = ffmpegdec->context->skip_loop_filter;
+  job->skip_idct = ffmpegdec->context->skip_idct;
+  av_packet_move_ref (job->packet, packet);
+
+  g_mutex_lock (&ffmpegdec->parallel_lock);
+  g_queue_push_tail (&ffmpegdec->parallel_jobs, job);
+  g_mutex_unlock (&ffmpegdec->parallel_lock);
+
+  g_thread_pool_push (ffmpegdec->parallel_pool, job, NULL);
+
+  return gst_ffmpegviddec_parallel_output (ffmpegdec, ffmpegdec->parallel_n);
+}
+
 
  /* Returns: Whether a frame was decoded */
 static gboolean
@@ -1827,6 +3571,12 @@ gst_ffmpegviddec_drain (GstVideoDecoder * decoder)
   if (!ffmpegdec->opened)
     return GST_FLOW_OK;
 
+  if (ffmpegdec->parallel_pool) {
+    ret = gst_ffmpegviddec_parallel_output (ffmpegdec, 0);
+    if (ret != GST_FLOW_OK)
+      return ret;
+  }
+
   if (avcodec_send_packet (ffmpegdec->context, NULL))
     goto send_packet_failed;
 
@@ -1834,6 +3584,15 @@ gst_ffmpegviddec_drain (GstVideoDecoder * decoder)
     got_frame = gst_ffmpegviddec_frame (ffmpegdec, NULL, &ret);
   } while (got_frame && ret == GST_FLOW_OK);
   avcodec_flush_buffers (ffmpegdec->context);
+  gst_ffmpegviddec_clear_pending_frames (ffmpegdec);
+
+  /* make sure everything was pushed before e.g. EOS goes downstream */
+  if (ffmpegdec->output_probe) {
+    GstFlowReturn output_ret = gst_ffmpegviddec_wait_output (ffmpegdec);
+
+    if (ret == GST_FLOW_OK || ret == GST_FLOW_EOS)
+      ret = output_ret;
+  }
 
   /* FFMpeg will return AVERROR_EOF if it's internal was fully drained
    * then we are translating it to GST_FLOW_EOS. However, because this behavior
@@ -1851,15 +3610,279 @@ send_packet_failed:
   goto done;
 }
 
+/* Drain the codec and open it again with the current input caps, picking up
+ * any setting that can't be changed on an opened context */
+static gboolean
+gst_ffmpegviddec_reopen (GstFFMpegVidDec * ffmpegdec)
+{
+  GstVideoCodecState *state;
+  gboolean ret;
+
+  if (ffmpegdec->input_state == NULL)
+    return FALSE;
+
+  /* force set_format() to reopen the codec with the same input caps */
+  state = gst_video_codec_state_ref (ffmpegdec->input_state);
+  gst_caps_replace (&ffmpegdec->last_caps, NULL);
+  ffmpegdec->force_reopen = TRUE;
+  ret = gst_ffmpegviddec_set_format (GST_VIDEO_DECODER (ffmpegdec), state);
+  ffmpegdec->force_reopen = FALSE;
+  gst_video_codec_state_unref (state);
+
+  if (!ret)
+    GST_WARNING_OBJECT (ffmpegdec, "failed to reopen codec");
+
+  return ret;
+}
+
+/* Reopen the codec so that the pool previously rejected by
+ * decide_allocation becomes the direct rendering pool. The stride is picked
+ * up again from the first buffer libav requests. */
+static void
+gst_ffmpegviddec_adopt_pending_pool (GstFFMpegVidDec * ffmpegdec)
+{
+  GstVideoDecoder *decoder = GST_VIDEO_DECODER (ffmpegdec);
+  GstBufferPool *pool;
+
+  pool = ffmpegdec->pending_pool;
+  ffmpegdec->pending_pool = NULL;
+
+  GST_DEBUG_OBJECT (ffmpegdec, "reopening codec to use downstream pool %"
+      GST_PTR_FORMAT, pool);
+
+  if (!gst_ffmpegviddec_reopen (ffmpegdec)) {
+    gst_object_unref (pool);
+    return;
+  }
+
+  if (ffmpegdec->internal_pool)
+    gst_object_unref (ffmpegdec->internal_pool);
+  ffmpegdec->internal_pool = pool;
+  ffmpegdec->pool_width = GST_VIDEO_INFO_WIDTH (&ffmpegdec->pending_info);
+  ffmpegdec->pool_height = ffmpegdec->pending_height;
+  ffmpegdec->pool_info = ffmpegdec->pending_info;
+
+  /* let the base class pick the adopted pool as output pool right away */
+  if (ffmpegdec->output_state)
+    gst_video_decoder_negotiate (decoder);
+}
+
+static GstStructure *
+gst_ffmpegviddec_get_stats (GstFFMpegVidDec * ffmpegdec)
+{
+  GstStructure *stats;
+
+  stats = gst_structure_new ("avviddec-stats",
+      "frames-in", G_TYPE_UINT64, STATS_GET (ffmpegdec, frames_in),
+      "frames-out", G_TYPE_UINT64, STATS_GET (ffmpegdec, frames_out),
+      "qos-dropped", G_TYPE_UINT64, STATS_GET (ffmpegdec, qos_dropped),
+      "dr-frames", G_TYPE_UINT64, STATS_GET (ffmpegdec, dr_frames),
+      "wrapped-frames", G_TYPE_UINT64, STATS_GET (ffmpegdec, wrapped_frames),
+      "copied-frames", G_TYPE_UINT64, STATS_GET (ffmpegdec, copied_frames),
+      "converted-frames", G_TYPE_UINT64,
+      STATS_GET (ffmpegdec, converted_frames),
+      "preroll-frames", G_TYPE_UINT64, STATS_GET (ffmpegdec, preroll_frames),
+      "scrub-hits", G_TYPE_UINT64, STATS_GET (ffmpegdec, scrub_hits),
+      "packet-copies", G_TYPE_UINT64, STATS_GET (ffmpegdec, packet_copies),
+      "pool-allocations", G_TYPE_UINT64,
+      STATS_GET (ffmpegdec, pool_allocations),
+      "threads", G_TYPE_INT, ffmpegdec->context->thread_count, NULL);
+  gst_ffmpeg_stats_set_decode_time_histogram (stats,
+      ffmpegdec->stats.decode_time);
+
+  return stats;
+}
+
+/* Posts the stats as element message once per stats-interval */
+static void
+gst_ffmpegviddec_post_stats (GstFFMpegVidDec * ffmpegdec)
+{
+  GstClockTime now;
+
+  if (ffmpegdec->stats_interval == 0)
+    return;
+
+  now = gst_util_get_timestamp ();
+  if (GST_CLOCK_TIME_IS_VALID (ffmpegdec->stats_last_post) &&
+      now - ffmpegdec->stats_last_post <
+      ffmpegdec->stats_interval * GST_MSECOND)
+    return;
+
+  ffmpegdec->stats_last_post = now;
+  gst_element_post_message (GST_ELEMENT_CAST (ffmpegdec),
+      gst_message_new_element (GST_OBJECT_CAST (ffmpegdec),
+          gst_ffmpegviddec_get_stats (ffmpegdec)));
+}
+
+/* Records how long the streaming thread spent in libav for the last packet
+ * and how many pictures that gave, compared against the frame duration when
+ * retuning the thread count */
+static void
+gst_ffmpegviddec_update_decode_time (GstFFMpegVidDec * ffmpegdec,
+    GstVideoCodecFrame * frame, GstClockTime elapsed, guint n_frames)
+{
+  GstClockTime duration = frame->duration;
+
+  if (!GST_CLOCK_TIME_IS_VALID (duration) && ffmpegdec->input_state
+      && ffmpegdec->input_state->info.fps_n > 0)
+    duration = gst_util_uint64_scale (GST_SECOND,
+        ffmpegdec->input_state->info.fps_d, ffmpegdec->input_state->info.fps_n);
+  if (!GST_CLOCK_TIME_IS_VALID (duration) || duration == 0)
+    return;
+
+  ffmpegdec->frame_duration = duration;
+  ffmpegdec->decode_time += elapsed;
+  ffmpegdec->decode_time_frames += n_frames;
+}
+
+/* Called on keyframes, reopens the codec with as many threads as the decoding
+ * cost per frame needs to stay below the high load, or with one thread less
+ * when that still leaves plenty of headroom.
+ *
+ * The streaming thread only waits in libav for what the threads could not do
+ * in parallel: with slice threading they share each frame, and with frame
+ * threading each frame keeps one thread busy for as long as the streaming
+ * thread takes to go through all of them. Either way the time spent in libav
+ * per output picture times the thread count is the cost of a frame in thread
+ * time. It is a lower bound when libav is not the bottleneck, so lowering
+ * and raising again backs off the next retune. */
+static void
+gst_ffmpegviddec_tune_threads (GstFFMpegVidDec * ffmpegdec)
+{
+  gint threads, max_threads, needed;
+  GstClockTime now;
+  gdouble cost;
+
+  if (ffmpegdec->decode_time_frames < ADAPTIVE_THREADS_MIN_FRAMES)
+    return;
+
+  now = gst_util_get_timestamp ();
+  if (GST_CLOCK_TIME_IS_VALID (ffmpegdec->adaptive_last_change) &&
+      now - ffmpegdec->adaptive_last_change < ffmpegdec->adaptive_interval)
+    return;
+
+  threads = ffmpegdec->adaptive_thread_count;
+  /* in frame durations */
+  cost = (gdouble) ffmpegdec->decode_time * threads /
+      ffmpegdec->decode_time_frames / ffmpegdec->frame_duration;
+  ffmpegdec->decode_time = 0;
+  ffmpegdec->decode_time_frames = 0;
+
+  max_threads = ffmpegdec->max_threads ? ffmpegdec->max_threads :
+      MIN (gst_ffmpeg_auto_max_threads (), 16);
+  if (ffmpegdec->frame_thread_cap > 0)
+    max_threads = MIN (max_threads, ffmpegdec->frame_thread_cap);
+
+  needed = CLAMP ((gint) (cost / ADAPTIVE_THREADS_HIGH_LOAD) + 1, 1,
+      max_threads);
+  if (needed > threads) {
+    if (ffmpegdec->adaptive_lowered)
+      ffmpegdec->adaptive_interval = MIN (ffmpegdec->adaptive_interval * 2,
+          ADAPTIVE_THREADS_MAX_INTERVAL);
+    ffmpegdec->adaptive_lowered = FALSE;
+  } else if (threads > 1 && cost / (threads - 1) < ADAPTIVE_THREADS_LOW_LOAD) {
+    needed = threads - 1;
+    ffmpegdec->adaptive_lowered = TRUE;
+  } else {
+    return;
+  }
+
+  GST_DEBUG_OBJECT (ffmpegdec, "decoding a frame costs %.2f frame durations, "
+      "switching from %d to %d threads, next retune in %" GST_TIME_FORMAT
+      " at the earliest", cost, threads, needed,
+      GST_TIME_ARGS (ffmpegdec->adaptive_interval));
+
+  ffmpegdec->adaptive_thread_count = needed;
+  ffmpegdec->adaptive_last_change = now;
+
+  gst_ffmpegviddec_reopen (ffmpegdec);
+}
+
+/* with STREAM_LOCK. Decodes the packets served from the scrub cache since
+ * the last keyframe again, without output, so that the frame following them
+ * finds its references */
+static void
+gst_ffmpegviddec_scrub_replay (GstFFMpegVidDec * ffmpegdec)
+{
+  GstBuffer *buf;
+  AVPacket packet;
+  gboolean copied, got_frame;
+  GstFlowReturn ret;
+
+  GST_DEBUG_OBJECT (ffmpegdec, "replaying %u packets",
+      g_queue_get_length (&ffmpegdec->scrub_replay));
+
+  while ((buf = g_queue_pop_head (&ffmpegdec->scrub_replay))) {
+    if (gst_ffmpeg_avpacket_from_buffer (&packet, buf, &copied)) {
+      ffmpegdec->context->reordered_opaque = SCRUB_REPLAY_OPAQUE;
+
+      GST_VIDEO_DECODER_STREAM_UNLOCK (ffmpegdec);
+      avcodec_send_packet (ffmpegdec->context, &packet);
+      GST_VIDEO_DECODER_STREAM_LOCK (ffmpegdec);
+
+      do {
+        got_frame = gst_ffmpegviddec_frame (ffmpegdec, NULL, &ret);
+      } while (got_frame && ret == GST_FLOW_OK);
+      av_packet_unref (&packet);
+    }
+    gst_buffer_unref (buf);
+  }
+}
+
+/* with STREAM_LOCK. Returns: whether @frame was finished from the scrub
+ * cache, in @ret */
+static gboolean
+gst_ffmpegviddec_scrub_serve (GstFFMpegVidDec * ffmpegdec,
+    GstVideoCodecFrame * frame, GstFlowReturn * ret)
+{
+  GstBuffer *buf;
+
+  buf = gst_ffmpegviddec_scrub_lookup (ffmpegdec, frame);
+  if (buf == NULL) {
+    GST_DEBUG_OBJECT (ffmpegdec, "leaving scrub cache at %" GST_TIME_FORMAT,
+        GST_TIME_ARGS (frame->pts));
+    ffmpegdec->scrub_serving = FALSE;
+
+    /* intra-only codecs and keyframes need no references */
+    if (!GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame)
+        && ffmpegdec->parallel_pool == NULL)
+      gst_ffmpegviddec_scrub_replay (ffmpegdec);
+    g_queue_clear_full (&ffmpegdec->scrub_replay,
+        (GDestroyNotify) gst_buffer_unref);
+    return FALSE;
+  }
+
+  if (GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame))
+    g_queue_clear_full (&ffmpegdec->scrub_replay,
+        (GDestroyNotify) gst_buffer_unref);
+  g_queue_push_tail (&ffmpegdec->scrub_replay,
+      gst_buffer_ref (frame->input_buffer));
+
+  GST_LOG_OBJECT (ffmpegdec, "serving %" GST_TIME_FORMAT " from scrub cache",
+      GST_TIME_ARGS (frame->pts));
+  STATS_INC (ffmpegdec, scrub_hits);
+  STATS_INC (ffmpegdec, frames_out);
+
+  GST_VIDEO_CODEC_FRAME_FLAG_UNSET (frame,
+      GST_VIDEO_CODEC_FRAME_FLAG_DECODE_ONLY);
+  frame->output_buffer = buf;
+  frame = gst_video_codec_frame_ref (frame);
+
+  *ret = gst_ffmpegviddec_finish_frame (ffmpegdec, frame);
+
+  return TRUE;
+}
+
 static GstFlowReturn
 gst_ffmpegviddec_handle_frame (GstVideoDecoder * decoder,
     GstVideoCodecFrame * frame)
 {
   GstFFMpegVidDec *ffmpegdec = (GstFFMpegVidDec *) decoder;
-  guint8 *data;
-  gint size;
   gboolean got_frame;
-  GstMapInfo minfo;
+  gboolean copied;
+  gboolean preroll;
+  GstClockTime start;
+  guint n_frames = 0;
   GstFlowReturn ret = GST_FLOW_OK;
   AVPacket packet;
 
@@ -1869,38 +3892,29 @@ gst_ffmpegviddec_handle_frame (GstVideoDecoder * decoder,
       gst_buffer_get_size (frame->input_buffer), GST_TIME_ARGS (frame->dts),
       GST_TIME_ARGS (frame->pts), GST_TIME_ARGS (frame->duration));
 
-  if (!gst_buffer_map (frame->input_buffer, &minfo, GST_MAP_READ)) {
+  /* hand the input memory to libav as a refcounted packet, so that it
+   * doesn't make its own copy */
+  if (!gst_ffmpeg_avpacket_from_buffer (&packet, frame->input_buffer,
+          &copied)) {
     GST_ELEMENT_ERROR (ffmpegdec, STREAM, DECODE, ("Decoding problem"),
         ("Failed to map buffer for reading"));
+    gst_video_codec_frame_unref (frame);
     return GST_FLOW_ERROR;
   }
 
-  /* treat frame as void until a buffer is requested for it */
-  GST_VIDEO_CODEC_FRAME_FLAG_SET (frame,
-      GST_VIDEO_CODEC_FRAME_FLAG_DECODE_ONLY);
-
-  data = minfo.data;
-  size = minfo.size;
-
-  if (size > 0 && (!GST_MEMORY_IS_ZERO_PADDED (minfo.memory)
-          || (minfo.maxsize - minfo.size) < AV_INPUT_BUFFER_PADDING_SIZE)) {
-    /* add padding */
-    if (ffmpegdec->padded_size < size + AV_INPUT_BUFFER_PADDING_SIZE) {
-      ffmpegdec->padded_size = size + AV_INPUT_BUFFER_PADDING_SIZE;
-      ffmpegdec->padded = g_realloc (ffmpegdec->padded, ffmpegdec->padded_size);
-      GST_LOG_OBJECT (ffmpegdec, "resized padding buffer to %d",
-          ffmpegdec->padded_size);
-    }
+  STATS_INC (ffmpegdec, frames_in);
+  if (copied) {
     GST_CAT_TRACE_OBJECT (GST_CAT_PERFORMANCE, ffmpegdec,
         "Copy input to add padding");
-    memcpy (ffmpegdec->padded, data, size);
-    memset (ffmpegdec->padded + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
-
-    data = ffmpegdec->padded;
+    STATS_INC (ffmpegdec, packet_copies);
   }
 
-  /* now decode the frame */
-  gst_avpacket_init (&packet, data, size);
+  /* treat frame as void until a buffer is requested for it */
+  GST_VIDEO_CODEC_FRAME_FLAG_SET (frame,
+      GST_VIDEO_CODEC_FRAME_FLAG_DECODE_ONLY);
+
+  if (!packet.size)
+    goto done;
 
   if (ffmpegdec->palette) {
     guint8 *pal;
@@ -1911,9 +3925,46 @@ gst_ffmpegviddec_handle_frame (GstVideoDecoder * decoder,
     GST_DEBUG_OBJECT (ffmpegdec, "copy pal %p %p", &packet, pal);
   }
 
-  if (!packet.size)
+  /* run QoS code. At the highest level, in keyframe trick modes and in
+   * thumbnail mode non-keyframes are dropped before decoding, libav would
+   * discard them anyway */
+  if (gst_ffmpegviddec_do_qos (ffmpegdec, frame)) {
+    GST_DEBUG_OBJECT (ffmpegdec, "dropping frame before decoding");
+    ret = gst_video_decoder_drop_frame (decoder, frame);
+    av_packet_unref (&packet);
+    return ret;
+  }
+
+  if (ffmpegdec->scrub_serving
+      && gst_ffmpegviddec_scrub_serve (ffmpegdec, frame, &ret))
     goto done;
 
+  /* after an accurate seek, frames before the segment start are only
+   * decoded as references for the following ones */
+  preroll = gst_ffmpegviddec_before_segment (ffmpegdec, frame);
+  if (preroll != ffmpegdec->preroll) {
+    GST_DEBUG_OBJECT (ffmpegdec, "%s pre-roll", preroll ? "entering" :
+        "leaving");
+    ffmpegdec->preroll = preroll;
+    gst_ffmpegviddec_apply_qos_level (ffmpegdec, ffmpegdec->qos_level);
+  }
+
+  /* libav can't change the stride of a running decoder, so a downstream
+   * pool with a different stride can only be adopted by reopening the codec
+   * on a keyframe */
+  if (G_UNLIKELY (ffmpegdec->pending_pool != NULL)
+      && GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame))
+    gst_ffmpegviddec_adopt_pending_pool (ffmpegdec);
+
+  if (G_UNLIKELY (ffmpegdec->latency_reopen)
+      && GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame))
+    gst_ffmpegviddec_reopen (ffmpegdec);
+  else if (ffmpegdec->adaptive_threads
+      && GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame))
+    gst_ffmpegviddec_tune_threads (ffmpegdec);
+
+  gst_ffmpegviddec_add_pending_frame (ffmpegdec, frame);
+
   /* save reference to the timing info */
   ffmpegdec->context->reordered_opaque = (gint64) frame->system_frame_number;
   ffmpegdec->picture->reordered_opaque = (gint64) frame->system_frame_number;
@@ -1921,21 +3972,31 @@ gst_ffmpegviddec_handle_frame (GstVideoDecoder * decoder,
   GST_DEBUG_OBJECT (ffmpegdec, "stored opaque values idx %d",
       frame->system_frame_number);
 
+  if (ffmpegdec->parallel_pool) {
+    ret = gst_ffmpegviddec_parallel_decode_frame (ffmpegdec, frame, &packet);
+    goto done;
+  }
+
   /* This might call into get_buffer() from another thread,
    * which would cause a deadlock. Release the lock here
    * and taking it again later seems safe
    * See https://bugzilla.gnome.org/show_bug.cgi?id=726020
    */
+  ffmpegdec->frame_decode_time = 0;
+  start = gst_util_get_timestamp ();
   GST_VIDEO_DECODER_STREAM_UNLOCK (ffmpegdec);
   if (avcodec_send_packet (ffmpegdec->context, &packet) < 0) {
     GST_VIDEO_DECODER_STREAM_LOCK (ffmpegdec);
     goto send_packet_failed;
   }
   GST_VIDEO_DECODER_STREAM_LOCK (ffmpegdec);
+  ffmpegdec->frame_decode_time += gst_util_get_timestamp () - start;
 
   do {
     /* decode a frame of audio/video now */
     got_frame = gst_ffmpegviddec_frame (ffmpegdec, frame, &ret);
+    if (got_frame)
+      n_frames++;
 
     if (ret != GST_FLOW_OK) {
       GST_LOG_OBJECT (ffmpegdec, "breaking because of flow ret %s",
@@ -1944,8 +4005,14 @@ gst_ffmpegviddec_handle_frame (GstVideoDecoder * decoder,
     }
   } while (got_frame);
 
+  gst_ffmpegviddec_update_decode_time (ffmpegdec, frame,
+      ffmpegdec->frame_decode_time, n_frames);
+  gst_ffmpeg_decode_time_histogram_add (ffmpegdec->stats.decode_time,
+      ffmpegdec->frame_decode_time);
+  gst_ffmpegviddec_post_stats (ffmpegdec);
+
 done:
-  gst_buffer_unmap (frame->input_buffer, &minfo);
+  av_packet_unref (&packet);
   gst_video_codec_frame_unref (frame);
 
   return ret;
@@ -1973,8 +4040,17 @@ gst_ffmpegviddec_start (GstVideoDecoder * decoder)
     return FALSE;
   }
   ffmpegdec->context->opaque = ffmpegdec;
+  memset (&ffmpegdec->stats, 0, sizeof (ffmpegdec->stats));
+  ffmpegdec->stats_last_post = GST_CLOCK_TIME_NONE;
   GST_OBJECT_UNLOCK (ffmpegdec);
 
+  if (ffmpegdec->async_output)
+    ffmpegdec->output_probe =
+        gst_pad_add_probe (GST_VIDEO_DECODER_SRC_PAD (ffmpegdec),
+        GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM |
+        GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM | GST_PAD_PROBE_TYPE_PUSH,
+        (GstPadProbeCallback) gst_ffmpegviddec_output_probe, ffmpegdec, NULL);
+
   return TRUE;
 }
 
@@ -1983,18 +4059,25 @@ gst_ffmpegviddec_stop (GstVideoDecoder * decoder)
 {
   GstFFMpegVidDec *ffmpegdec = (GstFFMpegVidDec *) decoder;
 
+  gst_ffmpegviddec_stop_output (ffmpegdec);
+  if (ffmpegdec->output_probe)
+    gst_pad_remove_probe (GST_VIDEO_DECODER_SRC_PAD (ffmpegdec),
+        ffmpegdec->output_probe);
+  ffmpegdec->output_probe = 0;
+
   GST_OBJECT_LOCK (ffmpegdec);
+  gst_ffmpegviddec_reset_qos (ffmpegdec);
+  gst_ffmpegviddec_cache_context (ffmpegdec);
   gst_ffmpegviddec_close (ffmpegdec, FALSE);
   GST_OBJECT_UNLOCK (ffmpegdec);
-  g_free (ffmpegdec->padded);
-  ffmpegdec->padded = NULL;
-  ffmpegdec->padded_size = 0;
   if (ffmpegdec->input_state)
     gst_video_codec_state_unref (ffmpegdec->input_state);
   ffmpegdec->input_state = NULL;
   if (ffmpegdec->output_state)
     gst_video_codec_state_unref (ffmpegdec->output_state);
   ffmpegdec->output_state = NULL;
+  gst_ffmpegviddec_clear_conversion (ffmpegdec);
+  gst_ffmpegviddec_scrub_clear (ffmpegdec);
 
   if (ffmpegdec->internal_pool)
     gst_object_unref (ffmpegdec->internal_pool);
@@ -2015,6 +4098,25 @@ gst_ffmpegviddec_stop (GstVideoDecoder * decoder)
   ffmpegdec->pool_width = 0;
   ffmpegdec->pool_height = 0;
   ffmpegdec->pool_format = 0;
+  ffmpegdec->have_videometa = FALSE;
+  if (ffmpegdec->pending_pool)
+    gst_object_unref (ffmpegdec->pending_pool);
+  ffmpegdec->pending_pool = NULL;
+  gst_ffmpegviddec_clear_pending_frames (ffmpegdec);
+
+  ffmpegdec->qos_frames_since_change = 0;
+  ffmpegdec->qos_early_frames = 0;
+  ffmpegdec->qos_dropped = 0;
+
+  ffmpegdec->reorder_frames = 0;
+  ffmpegdec->latency_reopen = FALSE;
+
+  ffmpegdec->adaptive_thread_count = 0;
+  ffmpegdec->adaptive_last_change = GST_CLOCK_TIME_NONE;
+  ffmpegdec->adaptive_interval = ADAPTIVE_THREADS_MIN_INTERVAL;
+  ffmpegdec->adaptive_lowered = FALSE;
+  ffmpegdec->decode_time = 0;
+  ffmpegdec->decode_time_frames = 0;
 
   return TRUE;
 }
@@ -2038,14 +4140,84 @@ gst_ffmpegviddec_flush (GstVideoDecoder * decoder)
 {
   GstFFMpegVidDec *ffmpegdec = (GstFFMpegVidDec *) decoder;
 
+  if (ffmpegdec->output_probe)
+    gst_ffmpegviddec_stop_output (ffmpegdec);
+
   if (ffmpegdec->opened) {
     GST_LOG_OBJECT (decoder, "flushing buffers");
     avcodec_flush_buffers (ffmpegdec->context);
   }
+  /* intra-only, so the parallel contexts keep no state worth flushing */
+  gst_ffmpegviddec_parallel_discard (ffmpegdec);
+  gst_ffmpegviddec_clear_pending_frames (ffmpegdec);
+  gst_ffmpegviddec_scrub_start (ffmpegdec);
+
+  gst_ffmpegviddec_reset_qos (ffmpegdec);
+
+  return TRUE;
+}
+
+/* libav needs every plane stride to be a multiple of the alignment it
+ * asks for, and to cover the aligned width */
+static gboolean
+gst_ffmpegviddec_stride_usable (GstFFMpegVidDec * ffmpegdec,
+    GstVideoMeta * vmeta, GstVideoInfo * info)
+{
+  GstVideoInfo aligned_info;
+  gint width, height;
+  gint linesize_align[AV_NUM_DATA_POINTERS];
+  guint i;
+
+  if (vmeta == NULL)
+    return FALSE;
+
+  width = GST_VIDEO_INFO_WIDTH (info);
+  height = MAX (GST_VIDEO_INFO_HEIGHT (info),
+      ffmpegdec->context->coded_height);
+  avcodec_align_dimensions2 (ffmpegdec->context, &width, &height,
+      linesize_align);
+
+  if (!gst_video_info_set_format (&aligned_info, GST_VIDEO_INFO_FORMAT (info),
+          width, height))
+    return FALSE;
+
+  for (i = 0; i < vmeta->n_planes; i++) {
+    if (vmeta->stride[i] < GST_VIDEO_INFO_PLANE_STRIDE (&aligned_info, i))
+      return FALSE;
+    if (linesize_align[i] > 0 && vmeta->stride[i] % linesize_align[i] != 0)
+      return FALSE;
+  }
 
   return TRUE;
 }
 
+/* An adopted pool is active and can't be configured again, check that it
+ * still produces buffers for the output state */
+static gboolean
+gst_ffmpegviddec_adopted_pool_fits (GstBufferPool * pool,
+    GstVideoCodecState * state)
+{
+  GstStructure *config;
+  GstCaps *caps = NULL;
+  GstVideoInfo info;
+  gboolean ret;
+
+  if (!gst_buffer_pool_is_active (pool))
+    return FALSE;
+
+  config = gst_buffer_pool_get_config (pool);
+  ret = gst_buffer_pool_config_get_params (config, &caps, NULL, NULL, NULL)
+      && caps != NULL && gst_video_info_from_caps (&info, caps)
+      && GST_VIDEO_INFO_FORMAT (&info) == GST_VIDEO_INFO_FORMAT (&state->info)
+      && GST_VIDEO_INFO_WIDTH (&info) == GST_VIDEO_INFO_WIDTH (&state->info)
+      && GST_VIDEO_INFO_HEIGHT (&info) == GST_VIDEO_INFO_HEIGHT (&state->info)
+      && gst_buffer_pool_config_has_option (config,
+      GST_BUFFER_POOL_OPTION_VIDEO_META);
+  gst_structure_free (config);
+
+  return ret;
+}
+
 static gboolean
 gst_ffmpegviddec_decide_allocation (GstVideoDecoder * decoder, GstQuery * query)
 {
@@ -2098,6 +4270,7 @@ gst_ffmpegviddec_decide_allocation (GstVideoDecoder * decoder, GstQuery * query)
 
   have_videometa =
       gst_query_find_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL);
+  ffmpegdec->have_videometa = have_videometa;
 
   if (have_videometa)
     gst_buffer_pool_config_add_option (config,
@@ -2106,8 +4279,23 @@ gst_ffmpegviddec_decide_allocation (GstVideoDecoder * decoder, GstQuery * query)
   have_alignment =
       gst_buffer_pool_has_option (pool, GST_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT);
 
-  /* If we have videometa, we never have to copy */
+  if (ffmpegdec->pending_pool)
+    gst_object_unref (ffmpegdec->pending_pool);
+  ffmpegdec->pending_pool = NULL;
+
+  /* The downstream pool was adopted after a stride renegotiation, it is
+   * already configured and active */
+  if (have_videometa && have_pool && pool == ffmpegdec->internal_pool &&
+      ffmpegdec->sws_context == NULL &&
+      gst_ffmpegviddec_can_direct_render (ffmpegdec) &&
+      gst_ffmpegviddec_adopted_pool_fits (pool, state)) {
+    gst_structure_free (config);
+    goto done;
+  }
+
+  /* If we have videometa, we never have to copy, unless we convert */
   if (have_videometa && have_pool && have_alignment &&
+      ffmpegdec->sws_context == NULL &&
       gst_ffmpegviddec_can_direct_render (ffmpegdec)) {
     GstStructure *config_copy = gst_structure_copy (config);
 
@@ -2123,11 +4311,17 @@ gst_ffmpegviddec_decide_allocation (GstVideoDecoder * decoder, GstQuery * query)
       ret = gst_buffer_pool_acquire_buffer (pool, &tmp, NULL);
       if (ret == GST_FLOW_OK) {
         GstVideoMeta *vmeta = gst_buffer_get_video_meta (tmp);
-        gboolean same_stride = TRUE;
+        gboolean usable, same_stride = TRUE;
         guint i;
 
-        for (i = 0; i < vmeta->n_planes; i++) {
-          if (vmeta->stride[i] != ffmpegdec->stride[i]) {
+        usable = gst_ffmpegviddec_stride_usable (ffmpegdec, vmeta,
+            &state->info);
+
+        /* nothing was decoded since the codec was (re)opened or flushed
+         * when the stride is still unset, any stride will do then */
+        for (i = 0; usable && i < vmeta->n_planes; i++) {
+          if (ffmpegdec->stride[i] != -1 &&
+              vmeta->stride[i] != ffmpegdec->stride[i]) {
             same_stride = FALSE;
             break;
           }
@@ -2135,7 +4329,10 @@ gst_ffmpegviddec_decide_allocation (GstVideoDecoder * decoder, GstQuery * query)
 
         gst_buffer_unref (tmp);
 
-        if (same_stride) {
+        if (!usable) {
+          GST_DEBUG_OBJECT (ffmpegdec, "downstream stride not usable by "
+              "libav, not direct rendering into downstream pool");
+        } else if (same_stride) {
           if (ffmpegdec->internal_pool)
             gst_object_unref (ffmpegdec->internal_pool);
           ffmpegdec->internal_pool = gst_object_ref (pool);
@@ -2147,6 +4344,18 @@ gst_ffmpegviddec_decide_allocation (GstVideoDecoder * decoder, GstQuery * query)
           gst_structure_free (config);
           goto done;
         }
+
+        /* Keep the configured pool around, it will replace the internal
+         * pool once the codec has been reopened on a keyframe */
+        if (ffmpegdec->stride_renegotiation) {
+          GST_DEBUG_OBJECT (ffmpegdec, "downstream stride differs, "
+              "renegotiating at next keyframe");
+          ffmpegdec->pending_pool = gst_object_ref (pool);
+          ffmpegdec->pending_info = state->info;
+          ffmpegdec->pending_height =
+              MAX (GST_VIDEO_INFO_HEIGHT (&state->info),
+              ffmpegdec->context->coded_height);
+        }
       }
     }
   }
@@ -2225,7 +4434,8 @@ gst_ffmpegviddec_set_property (GObject * object,
 
   switch (prop_id) {
     case PROP_LOWRES:
-      ffmpegdec->lowres = ffmpegdec->context->lowres = g_value_get_enum (value);
+      ffmpegdec->lowres = g_value_get_enum (value);
+      ffmpegdec->context->lowres = MAX (ffmpegdec->lowres, 0);
       break;
     case PROP_SKIPFRAME:
       ffmpegdec->skip_frame = ffmpegdec->context->skip_frame =
@@ -2247,6 +4457,40 @@ gst_ffmpegviddec_set_property (GObject * object,
     case PROP_THREAD_TYPE:
       ffmpegdec->thread_type = g_value_get_flags (value);
       break;
+    case PROP_STRIDE_RENEGOTIATION:
+      ffmpegdec->stride_renegotiation = g_value_get_boolean (value);
+      break;
+    case PROP_ASYNC_OUTPUT:
+      ffmpegdec->async_output = g_value_get_boolean (value);
+      break;
+    case PROP_ADAPTIVE_THREADS:
+      ffmpegdec->adaptive_threads = g_value_get_boolean (value);
+      break;
+    case PROP_SHARED_THREADS:
+      ffmpegdec->shared_threads = g_value_get_boolean (value);
+      break;
+    case PROP_MAX_LATENCY_FRAMES:
+      ffmpegdec->max_latency_frames = g_value_get_int (value);
+      break;
+    case PROP_CONTEXT_CACHE_TIME:
+      ffmpegdec->context_cache_time = g_value_get_uint (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      ffmpegdec->stats_interval = g_value_get_uint (value);
+      break;
+    case PROP_THUMBNAIL:
+      ffmpegdec->thumbnail = g_value_get_boolean (value);
+      break;
+    case PROP_OUTPUT_CONVERSION:
+      ffmpegdec->output_conversion = g_value_get_boolean (value);
+      break;
+    case PROP_PARALLEL_CONTEXTS:
+      ffmpegdec->parallel_contexts = g_value_get_int (value);
+      break;
+    case PROP_SCRUB_CACHE_SIZE:
+      /* shrinks to the new size as pictures are added */
+      ffmpegdec->scrub_cache_size = g_value_get_uint64 (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -2261,7 +4505,7 @@ gst_ffmpegviddec_get_property (GObject * object,
 
   switch (prop_id) {
     case PROP_LOWRES:
-      g_value_set_enum (value, ffmpegdec->context->lowres);
+      g_value_set_enum (value, ffmpegdec->lowres);
       break;
     case PROP_SKIPFRAME:
       g_value_set_enum (value, ffmpegdec->context->skip_frame);
@@ -2281,6 +4525,45 @@ gst_ffmpegviddec_get_property (GObject * object,
     case PROP_THREAD_TYPE:
       g_value_set_flags (value, ffmpegdec->thread_type);
       break;
+    case PROP_STRIDE_RENEGOTIATION:
+      g_value_set_boolean (value, ffmpegdec->stride_renegotiation);
+      break;
+    case PROP_ASYNC_OUTPUT:
+      g_value_set_boolean (value, ffmpegdec->async_output);
+      break;
+    case PROP_QOS_LEVEL:
+      g_value_set_enum (value, ffmpegdec->qos_level);
+      break;
+    case PROP_ADAPTIVE_THREADS:
+      g_value_set_boolean (value, ffmpegdec->adaptive_threads);
+      break;
+    case PROP_SHARED_THREADS:
+      g_value_set_boolean (value, ffmpegdec->shared_threads);
+      break;
+    case PROP_MAX_LATENCY_FRAMES:
+      g_value_set_int (value, ffmpegdec->max_latency_frames);
+      break;
+    case PROP_CONTEXT_CACHE_TIME:
+      g_value_set_uint (value, ffmpegdec->context_cache_time);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_ffmpegviddec_get_stats (ffmpegdec));
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, ffmpegdec->stats_interval);
+      break;
+    case PROP_THUMBNAIL:
+      g_value_set_boolean (value, ffmpegdec->thumbnail);
+      break;
+    case PROP_OUTPUT_CONVERSION:
+      g_value_set_boolean (value, ffmpegdec->output_conversion);
+      break;
+    case PROP_PARALLEL_CONTEXTS:
+      g_value_set_int (value, ffmpegdec->parallel_contexts);
+      break;
+    case PROP_SCRUB_CACHE_SIZE:
+      g_value_set_uint64 (value, ffmpegdec->scrub_cache_size);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -23,8 +23,27 @@
 #include <gst/video/video.h>
 #include <libavcodec/avcodec.h>
 
+#include "gstavutils.h"
+
 G_BEGIN_DECLS
 
+/* performance counters since start(), reported through the stats property */
+typedef struct
+{
+  guint frames_in;
+  guint frames_out;
+  guint qos_dropped;
+  guint dr_frames;
+  guint wrapped_frames;
+  guint copied_frames;
+  guint converted_frames;
+  guint preroll_frames;
+  guint scrub_hits;
+  guint packet_copies;
+  guint pool_allocations;
+  guint decode_time[GST_FFMPEG_DECODE_TIME_BUCKETS];
+} GstFFMpegVidDecStats;
+
 typedef struct _GstFFMpegVidDec GstFFMpegVidDec;
 struct _GstFFMpegVidDec
 {
@@ -59,9 +78,6 @@ struct _GstFFMpegVidDec
   gint ctx_time_n;
   GstBuffer *palette;
 
-  guint8 *padded;
-  gint padded_size;
-
   /* some properties */
   enum AVDiscard skip_frame;
   gint lowres;
@@ -70,15 +86,123 @@ struct _GstFFMpegVidDec
   int max_threads;
   gboolean output_corrupt;
   guint thread_type;
+  gboolean stride_renegotiation;
+  gboolean async_output;
+  gboolean thumbnail;
+  gboolean output_conversion;
+
+  /* QoS controller state */
+  gint qos_level;
+  guint qos_frames_since_change;
+  guint qos_early_frames;
+  guint64 qos_dropped;
+  /* frames skipped at least, because of trick modes or thumbnail mode */
+  enum AVDiscard trick_skip;
+  /* decoding frames that end before the segment start */
+  gboolean preroll;
+
+  /* adaptive-threads state */
+  gboolean adaptive_threads;
+  gboolean shared_threads;
+  gint max_latency_frames;
+  gint frame_thread_cap;
+  /* largest reordering delay libav reported, and whether it requires fewer
+   * frame threads than the codec was opened with */
+  gint reorder_frames;
+  gboolean latency_reopen;
+  gint adaptive_thread_count;
+  GstClockTime adaptive_last_change;
+  GstClockTime adaptive_interval;
+  gboolean adaptive_lowered;
+  GstClockTime frame_decode_time;
+  /* time spent in libav and pictures it output since the last retune */
+  GstClockTime decode_time;
+  GstClockTime frame_duration;
+  guint decode_time_frames;
 
   GstCaps *last_caps;
 
+  /* TRUE to close and open the codec on the next set_format() even if the
+   * codec context could be kept */
+  gboolean force_reopen;
+
+  /* opened contexts are left in the process-wide cache on stop() for this
+   * long, under context_key */
+  guint context_cache_time;
+  gchar *context_key;
+  /* pictures allocated through get_buffer2 not yet released by libav */
+  gint n_video_frames;
+
+  GstFFMpegVidDecStats stats;
+  guint stats_interval;
+  GstClockTime stats_last_post;
+
   /* Internally used for direct rendering */
   GstBufferPool *internal_pool;
   gint pool_width;
   gint pool_height;
   enum AVPixelFormat pool_format;
   GstVideoInfo pool_info;
+
+  /* converts the pictures to the negotiated format and size, if set */
+  struct SwsContext *sws_context;
+
+  /* TRUE when downstream accepts GstVideoMeta, so decoded frames that were
+   * not direct rendered can be pushed without copying */
+  gboolean have_videometa;
+
+  /* Downstream pool rejected because its stride differs from the one the
+   * codec was started with, adopted at the next keyframe */
+  GstBufferPool *pending_pool;
+  GstVideoInfo pending_info;
+  gint pending_height;
+
+  /* frames sent to libav, indexed by system_frame_number so get_buffer2
+   * doesn't have to walk the base class frame list. Protected by
+   * frames_lock as get_buffer2 can run from libav threads */
+  GMutex frames_lock;
+  GHashTable *pending_frames;
+  /* same frames in decoding order, not yet checked for being ghosts */
+  GQueue ghost_candidates;
+
+  /* async-output: output_probe takes the buffers the base class pushes and
+   * output_task pushes them downstream without the stream lock, so that
+   * pushing overlaps with decoding. Protected by output_lock */
+  gulong output_probe;
+  GstTask *output_task;
+  GRecMutex output_task_lock;
+  GMutex output_lock;
+  GCond output_cond;
+  GQueue output_queue;
+  gboolean output_busy;
+  GThread *output_thread;
+  gboolean output_flushing;
+  GstFlowReturn output_flow;
+
+  /* parallel-contexts: packets of intra-only codecs are decoded on
+   * parallel_n contexts from parallel_pool, and the pictures output in the
+   * order of parallel_jobs. parallel_idle holds the contexts not decoding */
+  gint parallel_contexts;
+  gint parallel_n;
+  GThreadPool *parallel_pool;
+  GAsyncQueue *parallel_idle;
+  GMutex parallel_lock;
+  GCond parallel_cond;
+  GQueue parallel_jobs;
+
+  /* scrub-cache-size: the last output pictures by input PTS, in
+   * scrub_lru order. After a flush they are served while the input hits
+   * them, scrub_replay keeps the packets served since the last keyframe */
+  guint64 scrub_cache_size;
+  guint64 scrub_cache_bytes;
+  GHashTable *scrub_cache;
+  GQueue scrub_lru;
+  GQueue scrub_replay;
+  gchar *scrub_stream_id;
+  gboolean scrub_serving;
+  /* the pool of the last cached picture, and whether it limits its buffers */
+  GstBufferPool *scrub_pool;
+  gboolean scrub_pool_limited;
 };
 
 typedef struct _GstFFMpegVidDecClass GstFFMpegVidDecClass;